@@ -38,7 +38,9 @@
 #include "cmixer.h"
 #include "sdist.h"
 #include "mgolfball.h"
+#include "mgolftrack.h"
 #include "maruco.h"
+#include "scam.h"
 
 #include "bseesaw.h"
 #include <iostream>
@@ -595,6 +597,8 @@ void BSeesaw::run_withGolf()
 
           mixer.setVelocity(0.1);
           pose.dist = 0;
+          // golf ball search is coming up, open camera now
+          cam.prewarm(20);
           state = 4;
           
         }
@@ -627,6 +631,7 @@ void BSeesaw::run_withGolf()
       case 41:
         if(pose.dist > 0.2){
           state = 5;
+          golftrack.reset();
           t.clear();
           }
         break;
@@ -641,14 +646,19 @@ void BSeesaw::run_withGolf()
         roi.push_back(cv::Point(600,190));  //point3
         roi.push_back(cv::Point(850,190));  //point4          
 
-        if(golfball.findGolfball(center, roi, nullptr) && (golfballTries < 100) && (t.getTimePassed() < 20)){
+        // tracker searches around the last found position, and
+        // gives a (predicted) position while the track is confident
+        if(golftrack.update(center, roi) && (golfballTries < 100) && (t.getTimePassed() < 20)){
             char s[MSL];
             snprintf(s, MSL, "Golfball found at X = %d, Y = %d", center[0], center[1]);
             toLog(s);
             int error_x = target_x - center[0];
             int error_y = target_y - center[1];
             golfballTries = 0;
-            if((abs(error_x) < deadband_x)&&(abs(error_y) < deadband_y)){
+            if(not golftrack.detected){
+              // predicted position is for steering only, grab when seen
+              state = (abs(error_x) < deadband_x) ? 52 : 51;
+            }else if((abs(error_x) < deadband_x)&&(abs(error_y) < deadband_y)){
               state = 53;
               hasGFB = true;
               mixer.setVelocity(0);
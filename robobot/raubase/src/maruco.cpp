@@ -38,6 +38,7 @@
 #include "maruco.h"
 #include "uservice.h"
 #include "scam.h"
+#include "uimagewriter.h"
 
 // create value
 MArUco aruco;
@@ -53,6 +54,35 @@ void MArUco::setup()
     ini["aruco"]["log"] = "true";
     ini["aruco"]["print"] = "true";
   }
+  if (not ini["aruco"].has("track"))
+  { // detector settings
+    ini["aruco"]["; search first around markers found in last frame"] = "";
+    ini["aruco"]["track"] = "true";
+    ini["aruco"]["; margin around predicted markers (fraction of marker side)"] = "";
+    ini["aruco"]["track_margin"] = "0.6";
+    ini["aruco"]["; full image search every n frames also when tracking"] = "";
+    ini["aruco"]["full_search_interval"] = "10";
+    ini["aruco"]["; full image search is on reduced image (scale 0.5 = half size)"] = "";
+    ini["aruco"]["search_scale"] = "0.5";
+    ini["aruco"]["adaptive_win"] = "3 23 10";
+    ini["aruco"]["min_perimeter_rate"] = "0.02";
+  }
+  trackEnabled = ini["aruco"]["track"] == "true";
+  trackMargin = strtof(ini["aruco"]["track_margin"].c_str(), nullptr);
+  fullSearchInterval = strtol(ini["aruco"]["full_search_interval"].c_str(), nullptr, 10);
+  searchScale = strtof(ini["aruco"]["search_scale"].c_str(), nullptr);
+  if (searchScale <= 0.1 or searchScale > 1.0)
+    searchScale = 1.0;
+  // persistent detector
+  dictionary = cv::aruco::getPredefinedDictionary(cv::aruco::DICT_4X4_250);
+  params = cv::aruco::DetectorParameters::create();
+  const char * p1 = ini["aruco"]["adaptive_win"].c_str();
+  params->adaptiveThreshWinSizeMin = strtol(p1, (char**)&p1, 10);
+  params->adaptiveThreshWinSizeMax = strtol(p1, (char**)&p1, 10);
+  params->adaptiveThreshWinSizeStep = strtol(p1, (char**)&p1, 10);
+  params->minMarkerPerimeterRate = strtof(ini["aruco"]["min_perimeter_rate"].c_str(), nullptr);
+  // corners are refined in the full size image after detection
+  params->cornerRefinementMethod = cv::aruco::CORNER_REFINE_NONE;
   // get values from ini-file
   fs::create_directory(ini["aruco"]["imagepath"]);
   //
@@ -84,6 +114,12 @@ void MArUco::terminate()
   // }
   if (logfile != nullptr)
   {
+    fprintf(logfile, "%% tracked search: %d frames, %.1f ms average, %d lost\n",
+            trackCnt, trackCnt > 0 ? trackMs / trackCnt : 0, trackLost);
+    fprintf(logfile, "%% full image search: %d frames, %.1f ms average\n",
+            fullCnt, fullCnt > 0 ? fullMs / fullCnt : 0);
+    fprintf(logfile, "%% image buffers: %d frames, %d allocations, %.0f bytes allocated per frame\n",
+            pool.frames, pool.allocations, pool.bytesPerFrame());
     fclose(logfile);
     logfile = nullptr;
   }
@@ -122,20 +158,43 @@ void MArUco::toLog(const char * message)
 
 int MArUco::findAruco(float size,bool raw, cv::Mat * sourcePtr)
 { // taken from https://docs.opencv.org
-  toLog("findAruco");
-  int count = 0;
-  cv::Mat frame;
-  cv::Ptr<cv::aruco::Dictionary> dictionary = cv::aruco::getPredefinedDictionary(cv::aruco::DICT_4X4_250);
   if (sourcePtr == nullptr)
-  { 
-    frame = raw ? cam.getFrameRaw() : cam.getFrame();
-    // frame = cam.getFrame();
-    imgTime = cam.imgTime;
+  { // use a frame newer than the last used by this detector,
+    // this may be a frame used by other detectors already
+    UFrame f;
+    if (not cam.waitFrameNewer(lastSeq, f))
+    {
+      printf("MVision::findAruco: Failed to get an image\n");
+      return 0;
+    }
+    return findAruco(size, f, raw);
   }
-  else
+  cv::Mat frame = *sourcePtr;
+  return detect(size, frame, imgTime);
+}
+
+int MArUco::findAruco(float size, const UFrame & source, bool raw, UArucoMarkers * result)
+{
+  lastSeq = source.seq;
+  // gray image is shared with other detectors using this frame
+  std::shared_ptr<UFrameImages> images = cam.cache.get(source);
+  cv::Mat frame = images->gray(not raw);
+  return detect(size, frame, source.t, result);
+}
+
+int MArUco::detect(float size, cv::Mat & frame, UTime t, UArucoMarkers * result)
+{ // may be used by both mission and vision thread
+  std::lock_guard<std::mutex> lock(detectLock);
+  if (result != nullptr)
   {
-    frame = *sourcePtr;
+    result->IDs.clear();
+    result->pos_m.clear();
+    result->rot_m.clear();
   }
+  imgTime = t;
+  timing.start();
+  toLog("findAruco");
+  int count = 0;
   //
   // printf("# MVision::findAruco looking for ArUco of size %.3fm\n", size);
   if (frame.empty())
@@ -143,27 +202,92 @@ int MArUco::findAruco(float size,bool raw, cv::Mat * sourcePtr)
     printf("MVision::findAruco: Failed to get an image\n");
     return 0;
   }
+  pool.newFrame();
   cv::Mat img;
   if (debugSave)
-    frame.copyTo(img);
+  {
+    img = pool.get(POOL_IMG, frame.size(), CV_8UC3);
+    if (frame.channels() == 1)
+      cv::cvtColor(frame, img, cv::COLOR_GRAY2BGR);
+    else
+      frame.copyTo(img);
+    timing.lap("debug");
+  }
   std::vector<std::vector<cv::Point2f>> markerCorners;
-  cv::aruco::detectMarkers(frame, dictionary, markerCorners, arID);
+  UPoseSample poseNow = pose.at(imgTime);
+  UTime t0;
+  t0.now();
+  const char * path = "full";
+  bool tracked = false;
+  cv::Rect roi;
+  if (trackEnabled and frame.size() == trackSize and not trackCorners.empty() and
+      framesSinceFull < fullSearchInterval)
+    roi = predictRoi(poseNow, frame.size());
+  if (not roi.empty())
+  { // search around the predicted markers only
+    cv::aruco::detectMarkers(frame(roi), dictionary, markerCorners, arID, params);
+    for (auto & mc : markerCorners)
+      for (auto & c : mc)
+        c += cv::Point2f(roi.x, roi.y);
+    timing.lap("track");
+    float ms = t0.getTimePassed() * 1000;
+    trackCnt++;
+    trackMs += ms;
+    tracked = not arID.empty();
+    if (tracked)
+    {
+      path = "track";
+      framesSinceFull++;
+    }
+    else
+      trackLost++;
+  }
+  if (not tracked)
+  { // full image, maybe at reduced size
+    UTime t1;
+    t1.now();
+    searchFull(frame, markerCorners);
+    framesSinceFull = 0;
+    fullCnt++;
+    fullMs += t1.getTimePassed() * 1000;
+  }
   count = arID.size();
-  // estimate pose of all markers
-  cv::aruco::estimatePoseSingleMarkers(markerCorners, size, cam.cameraMatrix, cam.distCoeffs, arRotate, arTranslate);
+  if (count > 0)
+  { // estimate pose of found markers only
+    cv::aruco::estimatePoseSingleMarkers(markerCorners, size, cam.cameraMatrix, cam.distCoeffs, arRotate, arTranslate);
+    timing.lap("pose");
+    trackCorners = markerCorners;
+    trackDistance.clear();
+    for (int i = 0; i < count; i++)
+      trackDistance.push_back(arTranslate[i][2]);
+    trackPose = poseNow;
+    trackSize = frame.size();
+  }
+  else
+  {
+    arRotate.clear();
+    arTranslate.clear();
+    trackCorners.clear();
+  }
+  {
+    const int MSL = 100;
+    char s[MSL];
+    snprintf(s, MSL, "detect path %s, found %d in %.1f ms", path, count, t0.getTimePassed() * 1000);
+    toLog(s);
+  }
   if(count)
   {
     toLog("Found Markers"); 
     fixTime = imgTime;
+    // where the robot was when the image was taken
+    fixPose = pose.at(imgTime);
     IDs = arID;
-    pos_m.clear();
-    rot_m.clear();
-    for (int i = 0; i < count; i++)
-    { // convert to robot coordinates
-      pos_m.push_back(cam.getPositionInRobotCoordinates(aruco.arTranslate[i]));
-      // rotation
-      rot_m.push_back(cam.getOrientationInRobotEulerAngles(aruco.arRotate[i], true));      
-    }
+    // convert to robot coordinates (all markers in one call)
+    pos_m.resize(count);
+    rot_m.resize(count);
+    cam.getPositionsInRobotCoordinates(arTranslate.data(), pos_m.data(), count);
+    cam.getOrientationsInRobotEulerAngles(arRotate.data(), rot_m.data(), count, true);
+    timing.lap("robot");
     
   }else{
   }
@@ -194,18 +318,123 @@ int MArUco::findAruco(float size,bool raw, cv::Mat * sourcePtr)
     }
     saveImageTimestamped(img, imgTime);
   }
+  if (result != nullptr and count > 0)
+  { // copy while locked
+    result->IDs = arID;
+    result->pos_m = pos_m;
+    result->rot_m = rot_m;
+  }
   return count;
 }
 
+void MArUco::searchFull(cv::Mat & frame, std::vector<std::vector<cv::Point2f>> & markerCorners)
+{
+  if (searchScale >= 0.99)
+  {
+    cv::aruco::detectMarkers(frame, dictionary, markerCorners, arID, params);
+    timing.lap("detect");
+    return;
+  }
+  cv::Size sz(roundf(frame.cols * searchScale), roundf(frame.rows * searchScale));
+  cv::Mat small = pool.get(POOL_SMALL, sz, frame.type());
+  cv::resize(frame, small, sz, 0, 0, cv::INTER_AREA);
+  timing.lap("resize");
+  cv::aruco::detectMarkers(small, dictionary, markerCorners, arID, params);
+  timing.lap("detect");
+  if (arID.empty())
+    return;
+  // scale corners back to full size, and refine there
+  cv::Mat gray;
+  if (frame.channels() == 1)
+    gray = frame;
+  else
+  {
+    gray = pool.get(POOL_GRAY, frame.size(), CV_8UC1);
+    cv::cvtColor(frame, gray, cv::COLOR_BGR2GRAY);
+    timing.lap("color");
+  }
+  int win = roundf(1.0 / searchScale) + 1;
+  cv::TermCriteria crit(cv::TermCriteria::MAX_ITER | cv::TermCriteria::EPS, 30, 0.05);
+  for (auto & mc : markerCorners)
+  {
+    for (auto & c : mc)
+      c *= 1.0 / searchScale;
+    cv::cornerSubPix(gray, mc, cv::Size(win, win), cv::Size(-1, -1), crit);
+  }
+  timing.lap("refine");
+}
+
+void MArUco::resetTrack()
+{
+  std::lock_guard<std::mutex> lock(detectLock);
+  trackCorners.clear();
+  trackDistance.clear();
+  framesSinceFull = 0;
+}
+
+cv::Rect MArUco::predictRoi(UPoseSample & now, cv::Size frameSize)
+{ // predict where the markers are now from the robot movement
+  // since last detection
+  float fx = cam.cameraMatrix.at<double>(0,0);
+  float cx = cam.cameraMatrix.at<double>(0,2);
+  float cy = cam.cameraMatrix.at<double>(1,2);
+  float dh = now.h2 - trackPose.h2;
+  if (dh > M_PI)
+    dh -= 2 * M_PI;
+  else if (dh < -M_PI)
+    dh += 2 * M_PI;
+  // driven distance in the heading direction of the last detection
+  float ds = (now.x2 - trackPose.x2) * cos(trackPose.h2) + (now.y2 - trackPose.y2) * sin(trackPose.h2);
+  // turning left moves the image to the right
+  float du = fx * tan(dh);
+  cv::Rect roi;
+  for (int i = 0; i < (int)trackCorners.size(); i++)
+  {
+    // markers grow when getting closer
+    float z = trackDistance[i];
+    float scale = z / fmaxf(z - ds, z * 0.25);
+    std::vector<cv::Point2f> predicted;
+    float side = 0;
+    for (int j = 0; j < (int)trackCorners[i].size(); j++)
+    {
+      cv::Point2f & c = trackCorners[i][j];
+      predicted.push_back(cv::Point2f(cx + (c.x - cx) * scale + du, cy + (c.y - cy) * scale));
+      if (j > 0)
+        side = fmaxf(side, cv::norm(predicted[j] - predicted[j - 1]));
+    }
+    cv::Rect r = cv::boundingRect(predicted);
+    int m = roundf(side * trackMargin);
+    r.x -= m;
+    r.y -= m;
+    r.width += 2 * m;
+    r.height += 2 * m;
+    roi |= r;
+  }
+  return roi & cv::Rect(0, 0, frameSize.width, frameSize.height);
+}
+
+bool MArUco::getMarkerNow(int i, cv::Vec3d & pos, cv::Vec3d & rot)
+{
+  if (i < 0 or i >= (int)pos_m.size() or i >= (int)rot_m.size())
+    return false;
+  float x = pos_m[i][0];
+  float y = pos_m[i][1];
+  float h = rot_m[i][2] * M_PI / 180.0;
+  pose.toCurrentFrame(fixPose, x, y, &h);
+  pos = cv::Vec3d(x, y, pos_m[i][2]);
+  rot = cv::Vec3d(rot_m[i][0], rot_m[i][1], h * 180.0 / M_PI);
+  return true;
+}
+
 void MArUco::saveImageInPath(cv::Mat& img, string name)
 { // Note, file type must be in filename
   const int MSL = 500;
   char s[MSL];
   // generate filename
   snprintf(s, MSL, "%s/%s", ini["aruco"]["imagepath"].c_str(), name.c_str());
-  // save
-  cv::imwrite(s, img);
-  printf("# saved image to %s\n", s);
+  // encoded and saved by the image writer thread
+  if (imageWriter.save(img, s))
+    printf("# saving image to %s\n", s);
 }
 
 
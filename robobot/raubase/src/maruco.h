@@ -24,12 +24,28 @@
 
 #include <opencv2/core.hpp>
 #include <opencv2/imgproc.hpp>
+#include <opencv2/aruco.hpp>
+#include <mutex>
 #include "utime.h"
+#include "mpose.h"
+#include "uframe.h"
+#include "umatpool.h"
+#include "ustagetimer.h"
 // #include "thread"
 
 
 using namespace std;
 
+/**
+ * Markers found in one image, copied while detection is locked */
+struct UArucoMarkers
+{
+  std::vector<int> IDs;
+  /// position and orientation (roll, pitch, yaw in degrees) in robot coordinates
+  std::vector<cv::Vec3d> pos_m;
+  std::vector<cv::Vec3d> rot_m;
+};
+
 /**
  * Class with example of vision processing
  * */
@@ -52,6 +68,20 @@ public:
    * this pointer is a nullptr (default), then a frame is taken from camera.
    * \returns the number of codes found. */
   int findAruco(float size,bool raw = false, cv::Mat * sourcePtr = nullptr);
+  /**
+   * Find ArUco code in this camera frame
+   * \param size is the side-size of the code.
+   * \param source is a frame from the camera (e.g. from cam.getNewestFrame()).
+   * \param raw if raw, distorted image should be used, else it is rectified first.
+   * \param result if not nullptr, then set to the markers found in this frame
+   *        (the public arID, pos_m and rot_m may be changed by another caller).
+   * \returns the number of codes found. */
+  int findAruco(float size, const UFrame & source, bool raw = false,
+                UArucoMarkers * result = nullptr);
+  /**
+   * Forget the markers from the last frame, so that the next
+   * search is in the full image (e.g. for unrelated images) */
+  void resetTrack();
   /**
    * Make an image with this ArUco ID */
   void saveCodeImage(int arucoID);
@@ -67,6 +97,17 @@ public:
   // bool use_raw = false;
 
   UTime fixTime;
+  /// robot pose when the image with the markers was taken
+  UPoseSample fixPose;
+  /**
+   * Get marker position and orientation in current robot coordinates,
+   * i.e. compensated for the robot movement since the image was taken.
+   * \param i is index to the found markers (IDs, pos_m and rot_m).
+   * \param pos is set to marker position (x,y,z) in current robot coordinates.
+   * \param rot is set to marker orientation (roll, pitch, yaw) in degrees,
+   *        where yaw is compensated for the robot turn.
+   * \returns false if i is not a valid index. */
+  bool getMarkerNow(int i, cv::Vec3d & pos, cv::Vec3d & rot);
   
   
   // Position in world frame
@@ -77,6 +118,8 @@ public:
   cv::Vec3d rot_w;
   // Marker rotations in robot frame
   std::vector<cv::Vec3d> rot_m;
+  /// time used by each processing stage for the last image
+  UStageTimer timing;
 
 
   // // Pos of robot in world coordinates (X,Y,Z)
@@ -93,6 +136,47 @@ protected:
 
 
 private:
+  /**
+   * Find codes in this image
+   * \param t is the image time
+   * \param result if not nullptr, then set to the found markers */
+  int detect(float size, cv::Mat & frame, UTime t, UArucoMarkers * result = nullptr);
+  /// detection may be called from more than one thread
+  std::mutex detectLock;
+  /// image buffers reused from frame to frame
+  UMatPool pool;
+  enum PoolStage {POOL_IMG, POOL_SMALL, POOL_GRAY};
+  /// persistent detector
+  cv::Ptr<cv::aruco::Dictionary> dictionary;
+  cv::Ptr<cv::aruco::DetectorParameters> params;
+  /**
+   * Search the full image at reduced size (searchScale),
+   * and refine the found corners in the full size image. */
+  void searchFull(cv::Mat & frame, std::vector<std::vector<cv::Point2f>> & markerCorners);
+  /**
+   * Predict the image area with the last found markers,
+   * from the robot movement since then.
+   * \param now is the robot pose at image time
+   * \returns the area to search (empty if outside image) */
+  cv::Rect predictRoi(UPoseSample & now, cv::Size frameSize);
+  /// tracking of markers from last frame
+  bool trackEnabled = true;
+  float trackMargin = 0.6;
+  int fullSearchInterval = 10;
+  float searchScale = 0.5;
+  std::vector<std::vector<cv::Point2f>> trackCorners;
+  std::vector<float> trackDistance;
+  UPoseSample trackPose;
+  cv::Size trackSize;
+  int framesSinceFull = 0;
+  /// timing statistics for each search path
+  int trackCnt = 0;
+  int trackLost = 0;
+  float trackMs = 0;
+  int fullCnt = 0;
+  float fullMs = 0;
+  /// sequence number of the last frame used
+  int lastSeq = 0;
   // static void runObj(MArUco * obj)
   // { // called, when thread is started
   //   // transfer to the class run() function.
@@ -48,6 +48,11 @@ void MEdge::setup()
     ini["edge"]["log"] = "true"; // log edge detection items
     ini["edge"]["logNorm"] = "true"; // log edge detection items
   }
+  if (not ini["edge"].has("history"))
+  { // number of edge samples saved for time lookup
+    ini["edge"]["history"] = "500";
+  }
+  history.setup(strtol(ini["edge"]["history"].c_str(), nullptr, 10));
   // get values from ini-file
   const char * p1 = ini["edge"]["calibWhite"].c_str();
   // white calibration value
@@ -255,6 +260,12 @@ void MEdge::run()
       if (not (sensorCalibrateWhite or sensorCalibrateBlack or sensorCalibrateWood))
       { // regular update
         findEdge();
+        UEdgeSample es;
+        es.edgeValid = edgeValid;
+        es.leftEdge = leftEdge;
+        es.rightEdge = rightEdge;
+        es.width = width;
+        history.add(updTime, es);
         // inform users of update
         updateCnt++;
       }
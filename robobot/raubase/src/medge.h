@@ -26,9 +26,35 @@
 
 #include "sedge.h"
 #include "utime.h"
+#include "uhistory.h"
 
 using namespace std;
 
+/**
+ * One edge detection sample for the history */
+class UEdgeSample
+{
+public:
+  bool edgeValid = false;
+  float leftEdge = 0.0;
+  float rightEdge = 0.0;
+  float width = 0.0;
+  /**
+   * Interpolate edge positions if both samples are valid,
+   * else use the nearest sample */
+  static UEdgeSample interpolate(const UEdgeSample & a, const UEdgeSample & b, float f)
+  {
+    if (not (a.edgeValid and b.edgeValid))
+      return (f < 0.5) ? a : b;
+    UEdgeSample r;
+    r.edgeValid = true;
+    r.leftEdge = a.leftEdge + f * (b.leftEdge - a.leftEdge);
+    r.rightEdge = a.rightEdge + f * (b.rightEdge - a.rightEdge);
+    r.width = a.width + f * (b.width - a.width);
+    return r;
+  }
+};
+
 /**
  * Class that extrach edge position of the line sensor
  * as well as crossing lines.
@@ -76,6 +102,8 @@ public:
   bool sensorCalibrateWhite = false;
   bool sensorCalibrateBlack = false;
   bool sensorCalibrateWood = false;
+  /// edge history (size from robot.ini)
+  UHistory<UEdgeSample> history;
 
 private:
   /// private stuff
@@ -39,6 +39,7 @@
 #include "mgolfball.h"
 #include "uservice.h"
 #include "scam.h"
+#include "uimagewriter.h"
 
 // create value
 Mgolfball golfball;
@@ -63,6 +64,24 @@ void Mgolfball::setup()
     ini["golfball"]["color_lb"] = "10 100 100";
     ini["golfball"]["color_ub"] = "20 255 255";
   }
+  if (not ini["golfball"].has("ball_radius"))
+  { // used to find ball position on the floor
+    ini["golfball"]["ball_radius"] = "0.021";
+  }
+  ballRadius = strtof(ini["golfball"]["ball_radius"].c_str(), nullptr);
+  if (not ini["golfball"].has("pyramid"))
+  { // search at half resolution first, then refine around candidates
+    ini["golfball"]["pyramid"] = "false";
+  }
+  usePyramid = ini["golfball"]["pyramid"] == "true";
+  if (not ini["golfball"].has("use_lut"))
+  { // colour classification by lookup table (bits per colour channel),
+    // 8 bits is exact, fewer bits is approximate (check with raubench first)
+    ini["golfball"]["use_lut"] = "false";
+    ini["golfball"]["lut_bits"] = "5";
+  }
+  useLut = ini["golfball"]["use_lut"] == "true";
+  colorLut.setBits(strtol(ini["golfball"]["lut_bits"].c_str(), nullptr, 10));
   // get values from ini-file
   fs::create_directory(ini["golfball"]["imagepath"]);
   //
@@ -107,6 +126,8 @@ void Mgolfball::terminate()
 { // wait for thread to finish
   if (logfile != nullptr)
   {
+    fprintf(logfile, "%% image buffers: %d frames, %d allocations, %.0f bytes allocated per frame\n",
+            pool.frames, pool.allocations, pool.bytesPerFrame());
     fclose(logfile);
     logfile = nullptr;
   }
@@ -132,18 +153,40 @@ bool Mgolfball::findGolfball(std::vector<int>& pos, std::vector<cv::Point> roi,
 
   // toLog("start find golfball");
   // Get frame 
-  cv::Mat frame;
   if (sourcePtr == nullptr)
-  {
-    frame = cam.getFrameRaw();
-    imgTime = cam.imgTime;
-  }
-  else
-  {
-    frame = *sourcePtr;
+  { // use a frame newer than the last used by this detector,
+    // this may be a frame used by other detectors already
+    UFrame f;
+    if (not cam.waitFrameNewer(lastSeq, f))
+    {
+      printf("MVision::findGolfball: Failed to get an image\n");
+      return false;
+    }
+    return findGolfball(pos, roi, f, density_thr, arg_minRad, arg_maxRad);
   }
-  //
-  if (frame.empty())
+  UFrame f;
+  f.img = *sourcePtr;
+  std::shared_ptr<UFrameImages> images = std::make_shared<UFrameImages>(f, nullptr);
+  return detect(pos, roi, images, imgTime, density_thr, arg_minRad, arg_maxRad);
+}
+
+bool Mgolfball::findGolfball(std::vector<int>& pos, std::vector<cv::Point> roi, const UFrame & source, float density_thr, int arg_minRad, int arg_maxRad)
+{
+  lastSeq = source.seq;
+  // decoded images are shared with other detectors using this frame
+  std::shared_ptr<UFrameImages> images = cam.cache.get(source);
+  return detect(pos, roi, images, source.t, density_thr, arg_minRad, arg_maxRad);
+}
+
+bool Mgolfball::detect(std::vector<int>& pos, std::vector<cv::Point> & roi, std::shared_ptr<UFrameImages> images, UTime t, float density_thr, int arg_minRad, int arg_maxRad)
+{ // may be used by both mission and vision thread
+  std::lock_guard<std::mutex> lock(detectLock);
+  imgTime = t;
+  pool.newFrame();
+  timing.start();
+  // full size image is decoded only when needed
+  cv::Size frameSize = images->size();
+  if (frameSize.empty())
   {
     printf("MVision::findGolfball: Failed to get an image\n");
     return 0;
@@ -166,37 +209,119 @@ bool Mgolfball::findGolfball(std::vector<int>& pos, std::vector<cv::Point> roi,
   // set bool to true if no of contours greater than 0
   // choose closest
 
-// Create a mask
-  cv::Mat ROI_mask = cv::Mat::zeros(frame.size(), CV_8UC1);
-  // std::vector<std::vector<cv::Point>> contour_vec;
-  // contour_vec.push_back(roi);
-  cv::fillConvexPoly(ROI_mask, roi, cv::Scalar(255, 255, 255));
-
-  // Apply the ROI_mask
+  // crop to the ROI bounding box, padded so that the blur
+  // gives the same result as on the full (masked) frame
+  cv::Rect frameRect(0, 0, frameSize.width, frameSize.height);
+  cv::Rect crop = cv::boundingRect(roi);
+  crop.x -= blurPad;
+  crop.y -= blurPad;
+  crop.width += 2 * blurPad;
+  crop.height += 2 * blurPad;
+  crop &= frameRect;
+  if (crop.empty())
+  {
+    toLog("ROI is outside image");
+    return false;
+  }
   cv::Mat frame_masked;
-  cv::bitwise_and(frame, frame, frame_masked, ROI_mask);
-
-  
-
+  auto maskFrame = [&]()
+  { // full resolution crop, masked by ROI
+    cv::Mat frame = images->full();
+    timing.lap("decode");
+    frame_masked = pool.get(POOL_MASKED, crop.size(), CV_8UC3);
+    frame_masked.setTo(cv::Scalar::all(0));
+    if (frame.size() == frameSize)
+      frame(crop).copyTo(frame_masked, roiMask(roi, frameSize, crop));
+    timing.lap("crop");
+  };
+  //
+  int minR = arg_minRad > 0 ? arg_minRad : minRad;
+  int maxR = arg_maxRad > 0 ? arg_maxRad : maxRad;
+  cv::Mat mask;
+  if (usePyramid and minR >= 4)
+  { // find candidates at half resolution,
+    // decoded at this size, if the camera thread has not decoded the frame
+    timing.lap("setup");
+    cv::Mat half = images->decoded(2);
+    timing.lap("decode");
+    if (half.empty())
+    {
+      printf("MVision::findGolfball: Failed to get an image\n");
+      return false;
+    }
+    cv::Rect smallCrop(crop.x / 2, crop.y / 2, (crop.width + 1) / 2, (crop.height + 1) / 2);
+    smallCrop &= cv::Rect(0, 0, half.cols, half.rows);
+    std::vector<cv::Point> smallRoi;
+    for (const cv::Point & p : roi)
+      smallRoi.push_back(p / 2);
+    cv::Size smallSize = smallCrop.size();
+    cv::Mat small = pool.get(POOL_SMALL, smallSize, half.type());
+    cv::Mat smallMask = pool.get(POOL_SMALL_MASK, smallSize, CV_8UC1);
+    small.setTo(cv::Scalar::all(0));
+    half(smallCrop).copyTo(small, roiMask(smallRoi, half.size(), smallCrop));
+    timing.lap("crop");
+    cv::GaussianBlur(small, small, cv::Size(5, 5), 0);
+    timing.lap("blur");
+    colorMask(small, smallMask);
+    cv::Mat labels = pool.get(POOL_LABELS, smallSize, CV_32S);
+    cv::Mat stats, centroids;
+    int n = cv::connectedComponentsWithStats(smallMask, labels, stats, centroids, 8, CV_32S);
+    timing.lap("candidates");
+    // refine at full resolution around candidates of a possible size only
+    mask = pool.get(POOL_MASK, crop.size(), CV_8UC1);
+    mask.setTo(cv::Scalar(0));
+    cv::Rect cropRect(0, 0, crop.width, crop.height);
+    // small crop position in full crop
+    cv::Point offset(smallCrop.x * 2 - crop.x, smallCrop.y * 2 - crop.y);
+    const int winPad = 4;
+    for (int i = 1; i < n; i++)
+    { // label 0 is background
+      int w = stats.at<int>(i, cv::CC_STAT_WIDTH);
+      int h = stats.at<int>(i, cv::CC_STAT_HEIGHT);
+      // enclosing circle radius (full resolution) is between max(w,h) and the diagonal
+      if (std::hypot(w, h) + 2 < minR or std::max(w, h) - 2 > maxR)
+        continue;
+      cv::Rect win(stats.at<int>(i, cv::CC_STAT_LEFT) * 2 + offset.x - winPad,
+                   stats.at<int>(i, cv::CC_STAT_TOP) * 2 + offset.y - winPad,
+                   w * 2 + 2 * winPad, h * 2 + 2 * winPad);
+      win &= cropRect;
+      if (frame_masked.empty())
+      { // a candidate, so full resolution is needed now
+        timing.lap("candidates");
+        maskFrame();
+      }
+      cv::Mat blurred;
+      // a sub-matrix is blurred using the pixels around it
+      cv::GaussianBlur(frame_masked(win), blurred, cv::Size(11, 11), 0);
+      timing.lap("blur");
+      cv::Mat winMask = mask(win);
+      colorMask(blurred, winMask);
+    }
+  }
+  else
+  { // full resolution for the whole ROI
+    timing.lap("setup");
+    maskFrame();
+    cv::Mat blurred = pool.get(POOL_BLURRED, crop.size(), frame_masked.type());
+    mask = pool.get(POOL_MASK, crop.size(), CV_8UC1);
+    cv::GaussianBlur(frame_masked, blurred, cv::Size(11, 11), 0);
+    timing.lap("blur");
+    colorMask(blurred, mask);
+  }
   cv::Mat img;
-  if (debugSave){
-    frame_masked.copyTo(img);
+  if (debugSave)
+  { // full size image for debug paint
+    if (frame_masked.empty())
+      maskFrame();
+    img = pool.get(POOL_IMG, frameSize, frame_masked.type());
+    img.setTo(cv::Scalar::all(0));
+    frame_masked.copyTo(img(crop));
+    timing.lap("debug");
   }
-    
-  cv::Mat blurred;
-  cv::GaussianBlur(frame_masked, blurred, cv::Size(11, 11), 0);
-  cv::Mat mask;
-  cv::cvtColor(blurred, mask, cv::COLOR_BGR2HSV);
-  cv::inRange(mask, cv::Scalar(c_lb1, c_lb2, c_lb3), cv::Scalar(c_ub1, c_ub2, c_ub3), mask);
-
-  // cv::inRange(mask, cv::Scalar(10, 100, 100), cv::Scalar(20, 255, 255), mask);
-  // cv::erode(mask, mask, Mat, 2);
-  // cv::dilate(mask, mask, Mat, 2);
-  
-  // toLog("start contour");
+  // contours in full image coordinates
   std::vector<std::vector<cv::Point>> contours;
-  cv::findContours(mask, contours, cv::noArray(),cv::RETR_EXTERNAL,cv::CHAIN_APPROX_SIMPLE);
-  // toLog("end contour");
+  cv::findContours(mask, contours, cv::noArray(),cv::RETR_EXTERNAL,cv::CHAIN_APPROX_SIMPLE, crop.tl());
+  timing.lap("contours");
 
   cv::Point2f center;
   float radius = 0;
@@ -208,10 +333,7 @@ bool Mgolfball::findGolfball(std::vector<int>& pos, std::vector<cv::Point> roi,
       // Fit enclosing circle and filter by min and max radius
       if (contours[i].size() > 0){
         cv::minEnclosingCircle(contours[i], center, radius);
-        if ((radius > (arg_minRad > 0 ? arg_minRad : minRad)) && (radius < (arg_maxRad > 0 ? arg_maxRad : maxRad))){
-          // std::cout << static_cast<int>(radius)<<std::endl;
-          // std::cout << density << std::endl;
-
+        if (radius > minR && radius < maxR){
           float area = cv::contourArea(contours[i]);
           float density = area/(CV_PI*std::pow(radius,2));
           if (density > max_density && density > density_thr){
@@ -219,66 +341,149 @@ bool Mgolfball::findGolfball(std::vector<int>& pos, std::vector<cv::Point> roi,
             c = center;
             r = radius;
           }
-
-          
-          cv::circle(img, center, static_cast<int>(radius), cv::Scalar(0,255,0), 2);
-          cv::circle(img, center, 1, cv::Scalar(0, 0, 255), 2);
+          if (debugSave)
+          {
+            cv::circle(img, center, static_cast<int>(radius), cv::Scalar(0,255,0), 2);
+            cv::circle(img, center, 1, cv::Scalar(0, 0, 255), 2);
+          }
         }
-
       }
     }
-    
-      
     pos[0] = static_cast<int>(c.x);
     pos[1] = static_cast<int>(c.y);
-      //
-
-      // toLog("start save");
+    timing.lap("select");
     if (debugSave){ 
       // paint found golfballs in image copy 'img'.
       // Draw circle and its center
       cv::circle(img, c, static_cast<int>(r), cv::Scalar(0,0,255), 2);
       cv::circle(img, c, 1, cv::Scalar(0, 0, 255), 2);
-      // snprintf(s, MSL, "center: (%d, %d), radius: %d", center[0], centert[1], radius);
-      // toLog(s);
       saveImageTimestamped(img, imgTime);
       saveImageTimestamped(mask, imgTime+1);
+      timing.lap("debug");
     }
-    // toLog("end save");
     if (c.x == -1){
       toLog("No Circle with sufficent radius found");
       return false;
     }
-    // toLog("end find golfball");
+    setFix(c, r);
+    timing.lap("pose");
     return true;
   }
   return false;
 }
 
+void Mgolfball::colorMask(const cv::Mat & bgr, cv::Mat & mask)
+{
+  cv::Scalar lb(c_lb1, c_lb2, c_lb3);
+  cv::Scalar ub(c_ub1, c_ub2, c_ub3);
+  if (useLut)
+  { // table is rebuilt only if bounds are changed
+    colorLut.setBounds(lb, ub);
+    colorLut.classify(bgr, mask);
+    // colour conversion is in the table
+    timing.lap("threshold");
+  }
+  else
+  {
+    cv::Mat hsv;
+    cv::cvtColor(bgr, hsv, cv::COLOR_BGR2HSV);
+    timing.lap("color");
+    cv::inRange(hsv, lb, ub, mask);
+    timing.lap("threshold");
+  }
+}
+
+void Mgolfball::benchmarkColor()
+{ // compare colour lookup table with HSV conversion on a camera image
+  cv::Mat frame = cam.getFrameRaw();
+  if (frame.empty())
+  {
+    printf("# Mgolfball::benchmarkColor: Failed to get an image\n");
+    return;
+  }
+  cv::Mat blurred;
+  cv::GaussianBlur(frame, blurred, cv::Size(11, 11), 0);
+  std::lock_guard<std::mutex> lock(detectLock);
+  colorLut.setBounds(cv::Scalar(c_lb1, c_lb2, c_lb3), cv::Scalar(c_ub1, c_ub2, c_ub3));
+  colorLut.benchmark(blurred);
+}
+
+const cv::Mat & Mgolfball::roiMask(const std::vector<cv::Point> & roi, cv::Size frameSize, cv::Rect crop)
+{ // polygon masks are reused, as missions use the same few ROIs,
+  // the mask depends on the crop too (half resolution ROIs are rounded)
+  for (URoiMask & m : roiMasks)
+  {
+    if (m.same(roi, frameSize, crop))
+      return m.mask;
+  }
+  for (auto it = roiMasksOnce.begin(); it != roiMasksOnce.end(); it++)
+  {
+    if (it->same(roi, frameSize, crop))
+    { // used again, so keep it
+      if (roiMasks.size() >= maxRoiMasks)
+        roiMasks.erase(roiMasks.begin());
+      roiMasks.push_back(std::move(*it));
+      roiMasksOnce.erase(it);
+      return roiMasks.back().mask;
+    }
+  }
+  // new ROI, e.g. a tracking window, that may be used this time only
+  if (roiMasksOnce.size() >= maxRoiMasksOnce)
+    roiMasksOnce.erase(roiMasksOnce.begin());
+  roiMasksOnce.emplace_back();
+  URoiMask & m = roiMasksOnce.back();
+  m.roi = roi;
+  m.frameSize = frameSize;
+  m.crop = crop;
+  m.mask = cv::Mat::zeros(crop.size(), CV_8UC1);
+  std::vector<cv::Point> poly;
+  for (const cv::Point & p : roi)
+    poly.push_back(p - crop.tl());
+  cv::fillConvexPoly(m.mask, poly, cv::Scalar(255));
+  return m.mask;
+}
+
 bool Mgolfball::findGolfballHough(std::vector<int>& pos, cv::Mat *sourcePtr)
 { // taken from https://docs.opencv.org
 
   bool found = false;
   // Get frame 
   cv::Mat frame;
+  std::shared_ptr<UFrameImages> images;
   if (sourcePtr == nullptr)
-  {
-    frame = cam.getFrameRaw();
-    imgTime = cam.imgTime;
+  { // use the frame cache, blur may be shared with other detectors
+    UFrame f;
+    if (cam.waitFrameNewer(lastSeq, f))
+    {
+      lastSeq = f.seq;
+      images = cam.cache.get(f);
+    }
   }
   else
   {
     frame = *sourcePtr;
   }
+  std::lock_guard<std::mutex> lock(detectLock);
+  timing.start();
+  if (images)
+  { // decoded here, if not by camera thread
+    imgTime = images->frame.t;
+    frame = images->full();
+  }
   //
   if (frame.empty())
   {
     printf("MVision::findGolfball: Failed to get an image\n");
     return 0;
   }
+  pool.newFrame();
   cv::Mat img;
   if (debugSave)
+  {
+    img = pool.get(POOL_HOUGH_IMG, frame.size(), frame.type());
     frame.copyTo(img);
+  }
+  timing.lap("decode");
   //=============================================
 
   // filter
@@ -290,21 +495,42 @@ bool Mgolfball::findGolfballHough(std::vector<int>& pos, cv::Mat *sourcePtr)
   // set bool to true if no of contours greater than 0
   // choose closest
   
+  cv::Mat mask = pool.get(POOL_HOUGH_MASK, frame.size(), CV_8UC1);
   cv::Mat blurred;
-  cv::GaussianBlur(frame, blurred, cv::Size(11, 11), 0);
-  cv::Mat mask;
-  cv::cvtColor(blurred, mask, cv::COLOR_BGR2HSV);
-  cv::inRange(mask, cv::Scalar(c_lb1, c_lb2, c_lb3), cv::Scalar(c_ub1, c_ub2, c_ub3), mask);
+  if (images and not useLut)
+  { // HSV conversion is cached too
+    blurred = images->blurred();
+    timing.lap("blur");
+    cv::Mat hsv = images->hsv();
+    timing.lap("color");
+    cv::inRange(hsv, cv::Scalar(c_lb1, c_lb2, c_lb3), cv::Scalar(c_ub1, c_ub2, c_ub3), mask);
+    timing.lap("threshold");
+  }
+  else
+  {
+    if (images)
+      blurred = images->blurred();
+    else
+    {
+      blurred = pool.get(POOL_HOUGH_BLURRED, frame.size(), frame.type());
+      cv::GaussianBlur(frame, blurred, cv::Size(11, 11), 0);
+    }
+    timing.lap("blur");
+    colorMask(blurred, mask);
+  }
   //  cv::erode(mask, mask, Mat, 2);
   // cv::dilate(mask, mask, Mat, 2);
   
     
   vector<cv::Vec3f> circles;
   cv::HoughCircles( mask, circles, cv::HOUGH_GRADIENT, 1, hough_minDist, hough_p1, hough_p2, minRad, maxRad );
+  timing.lap("hough");
 
   if(circles.size() > 0){
     pos[0] = cvRound(circles[0][0]);
     pos[1] = cvRound(circles[0][1]);
+    setFix(cv::Point2f(circles[0][0], circles[0][1]), circles[0][2]);
+    timing.lap("pose");
 
     for( size_t i = 0; i < circles.size(); i++ )
     {
@@ -333,15 +559,33 @@ bool Mgolfball::findGolfballHough(std::vector<int>& pos, cv::Mat *sourcePtr)
   
 }
 
+void Mgolfball::setFix(cv::Point2f center, float radius)
+{
+  fixTime = imgTime;
+  fixRadius = radius;
+  fixPose = pose.at(imgTime);
+  fixPosValid = cam.getFloorPosition(center, fixPos, false, ballRadius);
+}
+
+bool Mgolfball::getBallNow(float & x, float & y)
+{
+  if (not fixPosValid)
+    return false;
+  x = fixPos[0];
+  y = fixPos[1];
+  pose.toCurrentFrame(fixPose, x, y);
+  return true;
+}
+
 void Mgolfball::saveImageInPath(cv::Mat& img, string name)
 { // Note, file type must be in filename
   const int MSL = 500;
   char s[MSL];
   // generate filename
   snprintf(s, MSL, "%s/%s", ini["golfball"]["imagepath"].c_str(), name.c_str());
-  // save
-  cv::imwrite(s, img);
-  printf("# saved image to %s\n", s);
+  // encoded and saved by the image writer thread
+  if (imageWriter.save(img, s))
+    printf("# saving image to %s\n", s);
 }
 
 
@@ -23,7 +23,15 @@
 #pragma once
 
 #include <opencv2/core.hpp>
+#include <mutex>
+#include <vector>
 #include "utime.h"
+#include "mpose.h"
+#include "uframe.h"
+#include "uframecache.h"
+#include "ucolorlut.h"
+#include "umatpool.h"
+#include "ustagetimer.h"
 
 
 using namespace std;
@@ -47,6 +55,12 @@ public:
    * \param pos is a reference to the x,y postionn of the closest golfball
    * \returns the x,y position in pixel of the closes golf ball. */
   bool findGolfball(std::vector<int>& pos, std::vector<cv::Point> roi, cv::Mat *sourcePtr,float density_thr = 0.5, int arg_minRad = -1, int arg_maxRad = -1);
+  /**
+   * Find Golfball in this camera frame
+   * \param source is a (raw) frame from the camera (e.g. from cam.getNewestFrame()).
+   * other parameters as above.
+   * \returns true if a ball is found. */
+  bool findGolfball(std::vector<int>& pos, std::vector<cv::Point> roi, const UFrame & source, float density_thr = 0.5, int arg_minRad = -1, int arg_maxRad = -1);
 
    /**
    * Find Golfball code
@@ -55,6 +69,35 @@ public:
    * \param pos is a reference to the x,y postionn of the closest golfball
    * \returns the x,y position in pixel of the closes golf ball. */
   bool findGolfballHough(std::vector<int>& pos, cv::Mat *sourcePtr);
+  /**
+   * Get the last found ball position in current robot coordinates,
+   * i.e. compensated for the robot movement since the image was taken.
+   * \param x,y is set to ball position on the floor (x=forward, y=left).
+   * \returns false if no ball position is available. */
+  bool getBallNow(float & x, float & y);
+  /**
+   * Compare colour lookup table and HSV colour filter (time and result)
+   * on a camera image, result is printed to console. */
+  void benchmarkColor();
+  /**
+   * Image scale used by the (continuous) search, see UCam::setDecodeScale().
+   * With pyramid search, full resolution is used around candidates only. */
+  int decodeScale()
+  {
+    return usePyramid ? 2 : 1;
+  }
+
+  /// time of the image with the last found ball
+  UTime fixTime;
+  /// robot pose when that image was taken
+  UPoseSample fixPose;
+  /// ball position on the floor in robot coordinates (when image was taken)
+  cv::Vec3d fixPos;
+  bool fixPosValid = false;
+  /// radius (pixels) of the last found ball
+  float fixRadius = 0;
+  /// time used by each processing stage for the last image
+  UStageTimer timing;
  
 
 protected:
@@ -62,9 +105,57 @@ protected:
   UTime imgTime;
   void saveImageTimestamped(cv::Mat & img, UTime imgTime);
   void saveImageInPath(cv::Mat & img, string name);
+  /**
+   * Save time, pose and floor position for a found ball */
+  void setFix(cv::Point2f center, float radius);
 
 
 private:
+  /**
+   * Find ball in this image
+   * \param t is the image time */
+  bool detect(std::vector<int>& pos, std::vector<cv::Point> & roi, std::shared_ptr<UFrameImages> images, UTime t, float density_thr, int arg_minRad, int arg_maxRad);
+  /// detection may be called from more than one thread
+  std::mutex detectLock;
+  /**
+   * Get the ROI polygon mask for this crop of the frame,
+   * cached when the same ROI is used again (not a tracking window
+   * that moves every frame)
+   * \param crop is the (padded) ROI bounding box, the mask has this size */
+  const cv::Mat & roiMask(const std::vector<cv::Point> & roi, cv::Size frameSize, cv::Rect crop);
+  /// polygon mask for a ROI
+  struct URoiMask
+  {
+    std::vector<cv::Point> roi;
+    cv::Size frameSize;
+    cv::Rect crop;
+    cv::Mat mask;
+    bool same(const std::vector<cv::Point> & r, cv::Size f, cv::Rect c) const
+    {
+      return roi == r and frameSize == f and crop == c;
+    }
+  };
+  std::vector<URoiMask> roiMasks;
+  const size_t maxRoiMasks = 8;
+  /// masks used once only (recent), cached if used again
+  std::vector<URoiMask> roiMasksOnce;
+  const size_t maxRoiMasksOnce = 2;
+  /// crop padding, so that the 11x11 blur is unchanged inside the ROI
+  const int blurPad = 10;
+  /// search at half resolution first
+  bool usePyramid = false;
+  /**
+   * Make mask of pixels within the ball colour bounds */
+  void colorMask(const cv::Mat & bgr, cv::Mat & mask);
+  /// colour classification by lookup table
+  UColorLut colorLut;
+  bool useLut = false;
+  /// sequence number of the last frame used
+  int lastSeq = 0;
+  /// image buffers reused from frame to frame
+  UMatPool pool;
+  enum PoolStage {POOL_MASKED, POOL_SMALL, POOL_SMALL_MASK, POOL_LABELS, POOL_MASK,
+                  POOL_BLURRED, POOL_IMG, POOL_HOUGH_BLURRED, POOL_HOUGH_MASK, POOL_HOUGH_IMG};
   /**
    * print to console and logfile */
   void toLog(const char * message);
@@ -74,6 +165,8 @@ private:
   FILE * logfile = nullptr;
   /// save debug images
   bool debugSave = false;
+  /// ball radius (m) - height of ball centre over floor
+  float ballRadius = 0.021;
 };
 
 /**
@@ -0,0 +1,236 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#include <math.h>
+#include <opencv2/imgproc.hpp>
+
+#include "mgolftrack.h"
+#include "mgolfball.h"
+#include "scam.h"
+#include "uservice.h"
+
+// create value
+MGolfTrack golftrack;
+
+
+void MGolfTrack::setup()
+{ // ensure there is default values in ini-file
+  if (not ini.has("golftrack"))
+  { // no data yet, so generate some default values
+    ini["golftrack"]["log"] = "true";
+    ini["golftrack"]["print"] = "false";
+    ini["golftrack"]["; alpha-beta filter gains"] = "";
+    ini["golftrack"]["alpha"] = "0.6";
+    ini["golftrack"]["beta"] = "0.2";
+    ini["golftrack"]["; search window half size in ball radii (min pixels)"] = "";
+    ini["golftrack"]["window_radii"] = "3.0";
+    ini["golftrack"]["min_window"] = "40";
+    ini["golftrack"]["; window size factor for each miss"] = "";
+    ini["golftrack"]["widen"] = "1.5";
+    ini["golftrack"]["max_misses"] = "5";
+    ini["golftrack"]["confident_quality"] = "0.6";
+  }
+  toConsole = ini["golftrack"]["print"] == "true";
+  alpha = strtof(ini["golftrack"]["alpha"].c_str(), nullptr);
+  beta = strtof(ini["golftrack"]["beta"].c_str(), nullptr);
+  windowRadii = strtof(ini["golftrack"]["window_radii"].c_str(), nullptr);
+  minWindow = strtof(ini["golftrack"]["min_window"].c_str(), nullptr);
+  widen = strtof(ini["golftrack"]["widen"].c_str(), nullptr);
+  maxMisses = strtol(ini["golftrack"]["max_misses"].c_str(), nullptr, 10);
+  confidentQuality = strtof(ini["golftrack"]["confident_quality"].c_str(), nullptr);
+  // set by golfball setup
+  ballRadius = strtof(ini["golfball"]["ball_radius"].c_str(), nullptr);
+  //
+  if (ini["golftrack"]["log"] == "true")
+  { // open logfile
+    std::string fn = service.logPath + "log_golftrack.txt";
+    logfile = fopen(fn.c_str(), "w");
+    fprintf(logfile, "%% Golf ball tracker (%s)\n", fn.c_str());
+    fprintf(logfile, "%% 1 \tTime (sec) of image\n");
+    fprintf(logfile, "%% 2 \tDetected in this image (0/1)\n");
+    fprintf(logfile, "%% 3,4,5 \tEstimated ball position u,v and radius (pixels)\n");
+    fprintf(logfile, "%% 6,7 \tEstimated ball velocity (pixels/sec)\n");
+    fprintf(logfile, "%% 8 \tTrack quality [0..1]\n");
+    fprintf(logfile, "%% 9 \tMisses since last detection\n");
+    fprintf(logfile, "%% 10 \tSearch window size (pixels)\n");
+    fprintf(logfile, "%% 11 \tProcessing time (ms)\n");
+  }
+}
+
+void MGolfTrack::terminate()
+{
+  if (logfile != nullptr)
+  {
+    fclose(logfile);
+    logfile = nullptr;
+  }
+}
+
+void MGolfTrack::reset()
+{
+  tracking = false;
+  detected = false;
+  quality = 0;
+  misses = 0;
+  du = 0;
+  dv = 0;
+}
+
+bool MGolfTrack::update(std::vector<int> & pos, std::vector<cv::Point> roi,
+                        float density_thr, int minRad, int maxRad)
+{
+  UFrame frame;
+  if (not cam.waitFrameNewer(lastSeq, frame))
+    return false;
+  UTime t0;
+  t0.now();
+  lastSeq = frame.seq;
+  UPoseSample poseNow = pose.at(frame.t);
+  float dt = frame.t - imgTime;
+  // predicted position
+  float pu = u, pv = v;
+  std::vector<cv::Point> window = roi;
+  int winSize = 0;
+  if (tracking)
+  {
+    if (dt < 0 or dt > 1.0)
+      dt = 0;
+    // robot turn moves the image sideways (left turn moves image right)
+    float dh = poseNow.h2 - lastPose.h2;
+    if (dh > M_PI)
+      dh -= 2 * M_PI;
+    else if (dh < -M_PI)
+      dh += 2 * M_PI;
+    float fx = cam.cameraMatrix.at<double>(0,0);
+    float cx = cam.cameraMatrix.at<double>(0,2);
+    float cy = cam.cameraMatrix.at<double>(1,2);
+    // driven distance in the heading direction of the last image
+    float ds = (poseNow.x2 - lastPose.x2) * cos(lastPose.h2) +
+               (poseNow.y2 - lastPose.y2) * sin(lastPose.h2);
+    // ball grows and moves away from the image centre when getting closer,
+    // distance from the ball size (as for ArUco markers)
+    float scale = 1;
+    if (r > 1 and ballRadius > 0)
+    {
+      float z = fx * ballRadius / r;
+      scale = z / fmaxf(z - ds, z * 0.25);
+    }
+    pu = cx + (u - cx) * scale + du * dt + fx * tan(dh);
+    pv = cy + (v - cy) * scale + dv * dt;
+    r *= scale;
+    winSize = roundf(fmaxf(r * windowRadii, minWindow) * powf(widen, misses));
+    window = searchWindow(roi, pu, pv);
+    if (window.empty())
+      // prediction is outside the mission ROI
+      window = roi;
+    else if (r > 0 and minRad < 0 and maxRad < 0)
+    { // expect about the same radius
+      minRad = std::max(1, int(r * 0.6));
+      maxRad = int(r * 1.6) + 1;
+    }
+  }
+  std::vector<int> found = {0, 0};
+  detected = golfball.findGolfball(found, window, frame, density_thr, minRad, maxRad);
+  if (detected)
+  {
+    float mr = golfball.fixRadius;
+    if (tracking)
+    { // alpha-beta filter update
+      float eu = found[0] - pu;
+      float ev = found[1] - pv;
+      u = pu + alpha * eu;
+      v = pv + alpha * ev;
+      r = r + alpha * (mr - r);
+      if (dt > 0.001)
+      {
+        du += beta * eu / dt;
+        dv += beta * ev / dt;
+      }
+    }
+    else
+    { // new track
+      u = found[0];
+      v = found[1];
+      r = mr;
+      du = 0;
+      dv = 0;
+      tracking = true;
+    }
+    misses = 0;
+    quality = quality * 0.7 + 0.3;
+  }
+  else if (tracking)
+  { // keep the prediction
+    u = pu;
+    v = pv;
+    misses++;
+    quality *= 0.6;
+    if (misses > maxMisses)
+      reset();
+  }
+  imgTime = frame.t;
+  lastPose = poseNow;
+  bool valid = detected or confident();
+  if (valid)
+  {
+    pos[0] = roundf(u);
+    pos[1] = roundf(v);
+  }
+  const int MSL = 200;
+  char s[MSL];
+  snprintf(s, MSL, "%d %.1f %.1f %.1f %.1f %.1f %.3f %d %d %.1f", detected, u, v, r, du, dv,
+           quality, misses, winSize, t0.getTimePassed() * 1000);
+  toLog(s);
+  return valid;
+}
+
+std::vector<cv::Point> MGolfTrack::searchWindow(std::vector<cv::Point> & roi, float pu, float pv)
+{
+  float h = fmaxf(r * windowRadii, minWindow) * powf(widen, misses);
+  std::vector<cv::Point2f> box = {cv::Point2f(pu - h, pv - h), cv::Point2f(pu + h, pv - h),
+                                  cv::Point2f(pu + h, pv + h), cv::Point2f(pu - h, pv + h)};
+  std::vector<cv::Point2f> area;
+  for (const cv::Point & p : roi)
+    area.push_back(cv::Point2f(p.x, p.y));
+  std::vector<cv::Point2f> both;
+  std::vector<cv::Point> window;
+  if (area.size() < 3 or cv::intersectConvexConvex(area, box, both) <= 0)
+    return window;
+  for (const cv::Point2f & p : both)
+    window.push_back(cv::Point(roundf(p.x), roundf(p.y)));
+  return window;
+}
+
+void MGolfTrack::toLog(const char * message)
+{
+  if (not service.stop)
+  {
+    if (logfile != nullptr)
+    {
+      fprintf(logfile, "%lu.%04ld %s\n", imgTime.getSec(), imgTime.getMicrosec()/100, message);
+    }
+    if (toConsole)
+    {
+      printf("%lu.%04ld %s\n", imgTime.getSec(), imgTime.getMicrosec()/100, message);
+    }
+  }
+}
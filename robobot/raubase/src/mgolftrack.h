@@ -0,0 +1,108 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#pragma once
+
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "utime.h"
+#include "mpose.h"
+
+/**
+ * Golf ball tracker on top of the golfball detector.
+ * Keeps a filtered (alpha-beta) estimate of ball pixel position,
+ * radius and pixel velocity. The next search window is predicted
+ * from this estimate and the robot turn and forward movement
+ * since the last image,
+ * and the detector is used inside this window only.
+ * The window is widened after each miss, and the track is
+ * dropped (full ROI search) when quality is too low.
+ * */
+class MGolfTrack
+{
+public:
+  /** setup from robot.ini */
+  void setup();
+  /**
+   * terminate */
+  void terminate();
+  /**
+   * Forget the track, next update searches the full ROI */
+  void reset();
+  /**
+   * One tracking step on the next camera frame.
+   * \param pos is set to the (filtered) ball position in pixels,
+   *        if detected now or if the track is confident.
+   * \param roi is the mission search area (convex polygon),
+   *        the search window is limited to this area.
+   * other parameters as for golfball.findGolfball(...).
+   * \returns true if pos is valid. */
+  bool update(std::vector<int> & pos, std::vector<cv::Point> roi,
+              float density_thr = 0.5, int minRad = -1, int maxRad = -1);
+  /**
+   * Is the track good enough to use without a detection in this frame */
+  bool confident()
+  {
+    return tracking and quality >= confidentQuality;
+  }
+  /// filtered estimate (pixels and pixels per second)
+  float u = 0, v = 0, r = 0;
+  float du = 0, dv = 0;
+  /// track quality [0..1], increase on hits, decrease on misses
+  float quality = 0;
+  /// a track exists
+  bool tracking = false;
+  /// detected in last update
+  bool detected = false;
+  /// frames since last detection
+  int misses = 0;
+  /// time of last image used
+  UTime imgTime;
+
+private:
+  /**
+   * search window polygon for the predicted position,
+   * limited to the mission roi */
+  std::vector<cv::Point> searchWindow(std::vector<cv::Point> & roi, float pu, float pv);
+  void toLog(const char * message);
+  // filter and window parameters
+  float alpha = 0.6;
+  float beta = 0.2;
+  float windowRadii = 3.0;
+  float minWindow = 40;
+  float widen = 1.5;
+  int maxMisses = 5;
+  float confidentQuality = 0.6;
+  /// ball radius (m), to get distance from image size
+  float ballRadius = 0.021;
+  /// robot pose at last image
+  UPoseSample lastPose;
+  int lastSeq = 0;
+  bool toConsole = false;
+  FILE * logfile = nullptr;
+};
+
+/**
+ * Make this visible to the rest of the software */
+extern MGolfTrack golftrack;
+
@@ -48,6 +48,10 @@ void MPose::setup()
     ini["pose"]["log"] = "true";
     ini["pose"]["print"] = "false";
   }
+  if (not ini["pose"].has("history"))
+  { // number of poses saved for time lookup (at 8ms encoder rate)
+    ini["pose"]["history"] = "500";
+  }
   // get values from ini-file
   gear = strtof(ini["pose"]["gear"].c_str(), nullptr);
   const char * p1 = ini["pose"]["wheelDiameter"].c_str();
@@ -67,6 +71,7 @@ void MPose::setup()
   wheelBase = strtof(ini["pose"]["wheelBase"].c_str(), nullptr);
   for (int i = 0; i < 2; i++)
     distPerTick[i] = (wheelDiameter[i] * M_PI) / gear / encTickPerRev;
+  history.setup(strtol(ini["pose"]["history"].c_str(), nullptr, 10));
   //
   toConsole = ini["pose"]["print"] == "true";
   if (ini["pose"]["log"] == "true")
@@ -209,6 +214,17 @@ void MPose::run()
         turnRadius = robVel / minTurnrate * copysignf(1.0, turnrate);
       //
       poseTime = t;
+      // save to history
+      UPoseSample ps;
+      ps.x = x;
+      ps.y = y;
+      ps.h = h;
+      ps.dist = dist;
+      ps.turned = turned;
+      ps.x2 = x2;
+      ps.y2 = y2;
+      ps.h2 = h2;
+      history.add(t, ps);
       updateCnt++;
       // finished making a new pose
       toLog();
@@ -234,6 +250,84 @@ void MPose::resetPose()
   mixer.setDesiredHeading(0);
 }
 
+UPoseSample MPose::at(UTime t)
+{
+  UPoseSample ps;
+  if (not history.at(t, ps) and history.size() == 0)
+  { // no history yet, use current pose
+    ps.x = x;
+    ps.y = y;
+    ps.h = h;
+    ps.dist = dist;
+    ps.turned = turned;
+    ps.x2 = x2;
+    ps.y2 = y2;
+    ps.h2 = h2;
+  }
+  return ps;
+}
+
+void MPose::toCurrentFrame(const UPoseSample & then, float & x, float & y, float * h)
+{
+  UPoseSample now;
+  if (not history.newest(now))
+    return; // no movement
+  // to odometry coordinates (using the pose that is never reset)
+  float ch = cosf(then.h2);
+  float sh = sinf(then.h2);
+  float wx = then.x2 + ch * x - sh * y;
+  float wy = then.y2 + sh * x + ch * y;
+  // and back to robot coordinates at the current pose
+  ch = cosf(now.h2);
+  sh = sinf(now.h2);
+  float dx = wx - now.x2;
+  float dy = wy - now.y2;
+  x =  ch * dx + sh * dy;
+  y = -sh * dx + ch * dy;
+  if (h != nullptr)
+  { // heading relative to current robot heading
+    float rh = *h + then.h2 - now.h2;
+    if (rh > M_PI)
+      rh -= 2 * M_PI;
+    else if (rh < -M_PI)
+      rh += 2 * M_PI;
+    *h = rh;
+  }
+}
+
+UPoseSample UPoseSample::interpolate(const UPoseSample & a, const UPoseSample & b, float f)
+{
+  UPoseSample r;
+  r.x = a.x + f * (b.x - a.x);
+  r.y = a.y + f * (b.y - a.y);
+  r.dist = a.dist + f * (b.dist - a.dist);
+  r.turned = a.turned + f * (b.turned - a.turned);
+  r.x2 = a.x2 + f * (b.x2 - a.x2);
+  r.y2 = a.y2 + f * (b.y2 - a.y2);
+  // heading may fold between samples
+  float dh = b.h - a.h;
+  if (dh > M_PI)
+    dh -= 2 * M_PI;
+  else if (dh < -M_PI)
+    dh += 2 * M_PI;
+  r.h = a.h + f * dh;
+  if (r.h > M_PI)
+    r.h -= 2 * M_PI;
+  else if (r.h < -M_PI)
+    r.h += 2 * M_PI;
+  dh = b.h2 - a.h2;
+  if (dh > M_PI)
+    dh -= 2 * M_PI;
+  else if (dh < -M_PI)
+    dh += 2 * M_PI;
+  r.h2 = a.h2 + f * dh;
+  if (r.h2 > M_PI)
+    r.h2 -= 2 * M_PI;
+  else if (r.h2 < -M_PI)
+    r.h2 += 2 * M_PI;
+  return r;
+}
+
 void MPose::toLog()
 {
   if (not service.stop)
@@ -26,10 +26,29 @@
 
 #include "sencoder.h"
 #include "utime.h"
+#include "uhistory.h"
 #include "thread"
 
 using namespace std;
 
+/**
+ * One pose sample for the pose history.
+ * Both the pose that can be reset by missions (x,y,h)
+ * and the pose that is never reset (x2,y2,h2) are saved. */
+class UPoseSample
+{
+public:
+  float x = 0.0, y = 0.0, h = 0.0;
+  float dist = 0;
+  float turned = 0;
+  /// absolute pose (never reset)
+  float x2 = 0.0, y2 = 0.0, h2 = 0.0;
+  /**
+   * Interpolate between two samples,
+   * headings are interpolated the short way around. */
+  static UPoseSample interpolate(const UPoseSample & a, const UPoseSample & b, float f);
+};
+
 /**
  * Class that update robot based on wheel encoder update.
  * The result is odometry coordinate update
@@ -53,6 +72,21 @@ public:
   /**
    * Set pose to 0,0,0 */
   void resetPose();
+  /**
+   * Get the pose at this time, interpolated from the pose history.
+   * \param t is the time of interest, e.g. cam.imgTime.
+   * \returns pose at time t, if t is outside the history,
+   * then the oldest or newest pose in the history. */
+  UPoseSample at(UTime t);
+  /**
+   * Move a position seen in robot coordinates at an earlier pose
+   * to current robot coordinates, using the odometry since then.
+   * \param then is the pose when the position was valid, e.g. pose.at(cam.imgTime).
+   * \param x,y is position (forward, left) in robot coordinates at 'then',
+   *        and is changed to current robot coordinates.
+   * \param h if not nullptr, then a heading relative to the robot at 'then',
+   *        changed to be relative to the current heading. */
+  void toCurrentFrame(const UPoseSample & then, float & x, float & y, float * h = nullptr);
 
 protected:
   // robot geometry
@@ -78,6 +112,8 @@ public:
   float robVel = 0.0;
   // new pose is calculated count
   int updateCnt = 0;
+  /// pose history (size from robot.ini)
+  UHistory<UPoseSample> history;
 
 private:
   /// private stuff
@@ -0,0 +1,261 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#include <string.h>
+#include <math.h>
+#include "mvision.h"
+#include "maruco.h"
+#include "mgolfball.h"
+#include "scam.h"
+#include "uservice.h"
+
+// create value
+MVision vision;
+
+
+void MVision::setup()
+{ // ensure there is default values in ini-file
+  if (not ini.has("vision"))
+  { // no data yet, so generate some default values
+    ini["vision"]["log"] = "true";
+    ini["vision"]["print"] = "false";
+    ini["vision"]["golfball_fps"] = "10";
+    ini["vision"]["golfball_idle_fps"] = "2";
+    ini["vision"]["aruco_fps"] = "5";
+    ini["vision"]["aruco_idle_fps"] = "1";
+    ini["vision"]["; standing still below this velocity (m/s) and turnrate (rad/s)"] = "";
+    ini["vision"]["still_vel"] = "0.01";
+    ini["vision"]["still_turnrate"] = "0.05";
+  }
+  // get values from ini-file
+  toConsole = ini["vision"]["print"] == "true";
+  golfballFps = strtof(ini["vision"]["golfball_fps"].c_str(), nullptr);
+  golfballIdleFps = strtof(ini["vision"]["golfball_idle_fps"].c_str(), nullptr);
+  arucoFps = strtof(ini["vision"]["aruco_fps"].c_str(), nullptr);
+  arucoIdleFps = strtof(ini["vision"]["aruco_idle_fps"].c_str(), nullptr);
+  stillVel = strtof(ini["vision"]["still_vel"].c_str(), nullptr);
+  stillTurnrate = strtof(ini["vision"]["still_turnrate"].c_str(), nullptr);
+  // golfball is set up first, so the radius is in the ini-file
+  ballRadius = strtof(ini["golfball"]["ball_radius"].c_str(), nullptr);
+  if (ballRadius <= 0)
+    ballRadius = 0.021;
+  //
+  if (ini["vision"]["log"] == "true")
+  { // open logfile
+    std::string fn = service.logPath + "log_vision.txt";
+    logfile = fopen(fn.c_str(), "w");
+    fprintf(logfile, "%% Vision service (%s)\n", fn.c_str());
+    fprintf(logfile, "%% frame rate budget golfball %g (idle %g), aruco %g (idle %g) fps\n",
+            golfballFps, golfballIdleFps, arucoFps, arucoIdleFps);
+    fprintf(logfile, "%% 1 \tTime (sec) when processed\n");
+    fprintf(logfile, "%% 2 \tDetector (golfball or aruco)\n");
+    fprintf(logfile, "%% 3 \tFrame sequence number\n");
+    fprintf(logfile, "%% 4 \tImage age when processed (ms)\n");
+    fprintf(logfile, "%% 5 \tProcessing time (ms)\n");
+    fprintf(logfile, "%% 6 \tFound (golfball 0/1, aruco number of codes)\n");
+  }
+  th1 = new std::thread(runObj, this);
+}
+
+
+void MVision::terminate()
+{ // wait for thread to finish
+  if (th1 != nullptr)
+  {
+    th1->join();
+    th1 = nullptr;
+  }
+  if (logfile != nullptr)
+  {
+    fclose(logfile);
+    logfile = nullptr;
+  }
+}
+
+void MVision::enableGolfball(bool enable, std::vector<cv::Point> roi,
+                             float density_thr, int minRad, int maxRad)
+{
+  std::lock_guard<std::mutex> lock(dataLock);
+  golfballEnabled = enable;
+  golfballRoi = roi;
+  golfballDensity = density_thr;
+  golfballMinRad = minRad;
+  golfballMaxRad = maxRad;
+  // camera thread need not decode frames, if the search is at reduced size
+  cam.setDecodeScale("golfball", enable ? golfball.decodeScale() : 0);
+}
+
+void MVision::enableAruco(bool enable, float size, bool raw)
+{
+  std::lock_guard<std::mutex> lock(dataLock);
+  arucoEnabled = enable;
+  arucoSize = size;
+  arucoRaw = raw;
+  // markers are found in the luma only
+  cam.setDecodeScale("aruco", enable ? 1 : 0, true);
+}
+
+int MVision::getGolfball(UGolfballResult & result)
+{
+  std::lock_guard<std::mutex> lock(dataLock);
+  result = golfballResult;
+  return result.seq;
+}
+
+int MVision::getAruco(UArucoResult & result)
+{
+  std::lock_guard<std::mutex> lock(dataLock);
+  result = arucoResult;
+  return result.seq;
+}
+
+bool MVision::isDue(UTime & last, float fps, float idleFps, bool moving)
+{
+  float budget = moving ? fps : idleFps;
+  if (budget <= 0)
+    return false;
+  return last.getTimePassed() >= 1.0 / budget;
+}
+
+void MVision::run()
+{
+  int lastSeq = 0;
+  UFrame frame;
+  while (not service.stop)
+  {
+    bool useGolfball, useAruco;
+    {
+      std::lock_guard<std::mutex> lock(dataLock);
+      useGolfball = golfballEnabled;
+      useAruco = arucoEnabled;
+    }
+    if (not (useGolfball or useAruco))
+    { // nothing to do - let the camera stop decoding
+      usleep(20000);
+      continue;
+    }
+    // wait for a frame newer than the last one processed
+    if (not cam.waitFrameNewer(lastSeq, frame, 0.5))
+      continue;
+    lastSeq = frame.seq;
+    bool moving = fabsf(pose.robVel) > stillVel or fabsf(pose.turnrate) > stillTurnrate;
+    if (useGolfball and isDue(golfballLast, golfballFps, golfballIdleFps, moving))
+    {
+      golfballLast.now();
+      runGolfball(frame);
+    }
+    if (useAruco and isDue(arucoLast, arucoFps, arucoIdleFps, moving))
+    {
+      arucoLast.now();
+      runAruco(frame);
+    }
+  }
+}
+
+void MVision::runGolfball(const UFrame & frame)
+{
+  std::vector<cv::Point> roi;
+  float density;
+  int minRad, maxRad;
+  {
+    std::lock_guard<std::mutex> lock(dataLock);
+    roi = golfballRoi;
+    density = golfballDensity;
+    minRad = golfballMinRad;
+    maxRad = golfballMaxRad;
+  }
+  if (roi.empty())
+  { // whole image
+    roi = {cv::Point(0, 0), cv::Point(frame.size.width - 1, 0),
+           cv::Point(frame.size.width - 1, frame.size.height - 1), cv::Point(0, frame.size.height - 1)};
+  }
+  UTime t;
+  t.now();
+  std::vector<int> pos = {0, 0};
+  UGolfballResult r;
+  r.found = golfball.findGolfball(pos, roi, frame, density, minRad, maxRad);
+  r.seq = frame.seq;
+  r.imgTime = frame.t;
+  r.pose = pose.at(frame.t);
+  if (r.found)
+  {
+    r.px = pos[0];
+    r.py = pos[1];
+    r.floorValid = cam.getFloorPosition(cv::Point2f(r.px, r.py), r.floor, false, ballRadius);
+  }
+  r.procMs = t.getTimePassed() * 1000;
+  {
+    std::lock_guard<std::mutex> lock(dataLock);
+    golfballResult = r;
+    golfballUpdateCnt++;
+  }
+  toLog("golfball", r.seq, r.imgTime, r.procMs, r.found);
+}
+
+void MVision::runAruco(const UFrame & frame)
+{
+  float size;
+  bool raw;
+  {
+    std::lock_guard<std::mutex> lock(dataLock);
+    size = arucoSize;
+    raw = arucoRaw;
+  }
+  UTime t;
+  t.now();
+  UArucoResult r;
+  UArucoMarkers markers;
+  int n = aruco.findAruco(size, frame, raw, &markers);
+  r.seq = frame.seq;
+  r.imgTime = frame.t;
+  r.pose = pose.at(frame.t);
+  r.IDs.swap(markers.IDs);
+  r.pos_m.swap(markers.pos_m);
+  r.rot_m.swap(markers.rot_m);
+  r.procMs = t.getTimePassed() * 1000;
+  {
+    std::lock_guard<std::mutex> lock(dataLock);
+    arucoResult = r;
+    arucoUpdateCnt++;
+  }
+  toLog("aruco", r.seq, r.imgTime, r.procMs, n);
+}
+
+void MVision::toLog(const char * detector, int seq, UTime & imgTime, float ms, int found)
+{
+  if (not service.stop)
+  {
+    UTime t;
+    t.now();
+    float age = (t - imgTime) * 1000;
+    if (logfile != nullptr)
+    {
+      fprintf(logfile, "%lu.%04ld %s %d %.1f %.1f %d\n", t.getSec(), t.getMicrosec()/100,
+              detector, seq, age, ms, found);
+    }
+    if (toConsole)
+    {
+      printf("%lu.%04ld %s %d %.1f %.1f %d\n", t.getSec(), t.getMicrosec()/100,
+              detector, seq, age, ms, found);
+    }
+  }
+}
@@ -0,0 +1,165 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+
+#pragma once
+
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "utime.h"
+#include "mpose.h"
+#include "uframe.h"
+
+using namespace std;
+
+/**
+ * Golf ball detection result from the vision service */
+class UGolfballResult
+{
+public:
+  /// frame sequence number and image time
+  int seq = 0;
+  UTime imgTime;
+  bool found = false;
+  /// ball position in (raw) image pixels
+  int px = 0, py = 0;
+  /// ball position on floor in robot coordinates when image was taken
+  bool floorValid = false;
+  cv::Vec3d floor;
+  /// robot pose when image was taken
+  UPoseSample pose;
+  /// processing time (ms)
+  float procMs = 0;
+};
+
+/**
+ * ArUco detection result from the vision service */
+class UArucoResult
+{
+public:
+  /// frame sequence number and image time
+  int seq = 0;
+  UTime imgTime;
+  /// detected codes with position and orientation in robot coordinates
+  std::vector<int> IDs;
+  std::vector<cv::Vec3d> pos_m;
+  std::vector<cv::Vec3d> rot_m;
+  /// robot pose when image was taken
+  UPoseSample pose;
+  /// processing time (ms)
+  float procMs = 0;
+};
+
+/**
+ * Vision service.
+ * Runs the enabled detectors on new camera frames in its own thread,
+ * and publishes the timestamped results, so that missions
+ * can use the newest result without waiting.
+ * Each detector has a frame rate budget (from robot.ini), one
+ * when the robot is moving and a (lower) one when standing still.
+ * */
+class MVision
+{
+public:
+  /** setup and start thread */
+  void setup();
+  /**
+   * thread running the detectors */
+  void run();
+  /**
+   * terminate */
+  void terminate();
+  /**
+   * Enable (or disable) golf ball detection
+   * \param roi is the image area to search (polygon in pixels)
+   * other parameters as for golfball.findGolfball(...) */
+  void enableGolfball(bool enable, std::vector<cv::Point> roi = {},
+                      float density_thr = 0.5, int minRad = -1, int maxRad = -1);
+  /**
+   * Enable (or disable) ArUco detection
+   * \param size is the side size of the codes (m)
+   * \param raw if detection should use the raw (not rectified) image */
+  void enableAruco(bool enable, float size = 0.1, bool raw = false);
+  /**
+   * Get the newest golf ball result
+   * \returns the frame sequence number of the result (0 if no result yet) */
+  int getGolfball(UGolfballResult & result);
+  /**
+   * Get the newest ArUco result
+   * \returns the frame sequence number of the result (0 if no result yet) */
+  int getAruco(UArucoResult & result);
+
+public:
+  /// number of published results
+  int golfballUpdateCnt = 0;
+  int arucoUpdateCnt = 0;
+
+private:
+  static void runObj(MVision * obj)
+  { // called, when thread is started
+    // transfer to the class run() function.
+    obj->run();
+  }
+  /**
+   * Is it time for a detector with this budget */
+  bool isDue(UTime & last, float fps, float idleFps, bool moving);
+  void runGolfball(const UFrame & frame);
+  void runAruco(const UFrame & frame);
+  void toLog(const char * detector, int seq, UTime & imgTime, float ms, int found);
+  //
+  std::mutex dataLock;
+  // golfball settings
+  bool golfballEnabled = false;
+  std::vector<cv::Point> golfballRoi;
+  float golfballDensity = 0.5;
+  int golfballMinRad = -1;
+  int golfballMaxRad = -1;
+  /// golf ball radius (m), ball centre is this much above the floor
+  float ballRadius = 0.021;
+  float golfballFps = 10;
+  float golfballIdleFps = 2;
+  UTime golfballLast;
+  UGolfballResult golfballResult;
+  // ArUco settings
+  bool arucoEnabled = false;
+  float arucoSize = 0.1;
+  bool arucoRaw = false;
+  float arucoFps = 5;
+  float arucoIdleFps = 1;
+  UTime arucoLast;
+  UArucoResult arucoResult;
+  /// robot velocity (m/s) and turnrate (rad/s) considered standing still
+  float stillVel = 0.01;
+  float stillTurnrate = 0.05;
+  //
+  bool toConsole = false;
+  FILE * logfile = nullptr;
+  std::thread * th1 = nullptr;
+};
+
+/**
+ * Make this visible to the rest of the software */
+extern MVision vision;
+
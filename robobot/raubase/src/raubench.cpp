@@ -0,0 +1,312 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+/*
+ * Offline benchmark of the vision detectors.
+ * Runs golfball (contour and Hough) and ArUco detection on all images
+ * in a directory (e.g. images saved by the robot), without camera or robot.
+ * Reports time per processing stage, the detection results, and compares
+ * the results with an expected-results file (regression test).
+ * */
+
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <opencv2/imgcodecs.hpp>
+#include "CLI/CLI.hpp"
+
+#include "uservice.h"
+#include "scam.h"
+#include "mgolfball.h"
+#include "maruco.h"
+#include "ustagetimer.h"
+
+namespace fs = std::filesystem;
+
+/**
+ * Result of one detector on one image */
+struct UBenchResult
+{
+  bool found = false;
+  float x = 0, y = 0;
+  /// ArUco marker IDs (sorted)
+  std::vector<int> ids;
+  /// total time (ms)
+  float ms = 0;
+};
+
+/**
+ * Time statistics for one stage of a detector */
+struct UStageStat
+{
+  std::string name;
+  double sum = 0;
+  float max = 0;
+  int n = 0;
+};
+
+/// stage statistics for each detector, in order of first use
+std::map<std::string, std::vector<UStageStat>> stageStats;
+
+void addTiming(const std::string & detector, UStageTimer & timer)
+{
+  std::vector<UStageStat> & st = stageStats[detector];
+  for (UStageTimer::Stage & s : timer.stages)
+  {
+    UStageStat * ss = nullptr;
+    for (UStageStat & a : st)
+      if (a.name == s.name)
+        ss = &a;
+    if (ss == nullptr)
+    {
+      st.push_back(UStageStat());
+      ss = &st.back();
+      ss->name = s.name;
+    }
+    ss->sum += s.ms;
+    ss->n++;
+    if (s.ms > ss->max)
+      ss->max = s.ms;
+  }
+}
+
+/**
+ * Expected results file, one line per image and detector:
+ * image detector found x y [id ...]
+ * */
+std::map<std::string, UBenchResult> readExpected(const std::string & filename)
+{
+  std::map<std::string, UBenchResult> expected;
+  std::ifstream f(filename);
+  std::string line;
+  while (std::getline(f, line))
+  {
+    if (line.empty() or line[0] == '%' or line[0] == '#')
+      continue;
+    std::istringstream is(line);
+    std::string image, detector;
+    UBenchResult r;
+    int found;
+    is >> image >> detector >> found >> r.x >> r.y;
+    r.found = found != 0;
+    int id;
+    while (is >> id)
+      r.ids.push_back(id);
+    expected[image + " " + detector] = r;
+  }
+  return expected;
+}
+
+/**
+ * Compare result with expected
+ * \param tolerance is max position difference (pixels or m)
+ * \returns empty string if OK, else the difference */
+std::string compare(const UBenchResult & r, const UBenchResult & e, float tolerance)
+{
+  const int MSL = 200;
+  char s[MSL];
+  if (r.found != e.found)
+    snprintf(s, MSL, "found %d, expected %d", r.found, e.found);
+  else if (r.ids != e.ids)
+    snprintf(s, MSL, "found %d markers, expected %d (or other IDs)", (int)r.ids.size(), (int)e.ids.size());
+  else if (r.found and std::hypot(r.x - e.x, r.y - e.y) > tolerance)
+    snprintf(s, MSL, "at %.0f,%.0f, expected %.0f,%.0f", r.x, r.y, e.x, e.y);
+  else
+    s[0] = '\0';
+  return s;
+}
+
+int main(int argc, char **argv)
+{
+  CLI::App cli{"Offline benchmark of raubase vision detectors"};
+  std::string imageDir = "bench";
+  cli.add_option("images", imageDir, "Directory with images (.jpg or .png)");
+  std::string iniName = "robot.ini";
+  cli.add_option("--ini", iniName, "Configuration (detector settings and camera calibration)");
+  std::string detectors = "golfball,hough,aruco";
+  cli.add_option("-d,--detectors", detectors, "Detectors to run (golfball, hough, aruco)");
+  std::string expectedName;
+  cli.add_option("-e,--expected", expectedName, "Expected results file (default <images>/expected.txt)");
+  bool update{false};
+  cli.add_flag("-u,--update", update, "Write the results as the new expected results");
+  int loops = 1;
+  cli.add_option("-l,--loops", loops, "Run each detector this many times per image (timing)");
+  float arucoSize = 0.1;
+  cli.add_option("--aruco-size", arucoSize, "ArUco marker size (m)");
+  float tolerance = 3;
+  cli.add_option("--tolerance", tolerance, "Allowed golfball position difference (pixels)");
+  float arucoTolerance = 0.01;
+  cli.add_option("--aruco-tolerance", arucoTolerance, "Allowed marker position difference (m)");
+  bool save{false};
+  cli.add_flag("--save", save, "Save detector debug images");
+  CLI11_PARSE(cli, argc, argv);
+  if (expectedName.empty())
+    expectedName = imageDir + "/expected.txt";
+  if (loops < 1)
+    loops = 1;
+  // detector settings as on the robot, but no camera
+  mINI::INIFile iniFile(iniName);
+  iniFile.read(ini);
+  if (not ini.has("camera"))
+  {
+    printf("# raubase bench: needs camera calibration from %s\n", iniName.c_str());
+    return 2;
+  }
+  // camera calibration is used, but camera is not opened
+  ini["camera"]["enabled"] = "true";
+  ini["camera"]["capture"] = "false";
+  ini["camera"]["lazy"] = "true";
+  ini["camera"]["record"] = "false";
+  ini["camera"]["shm"] = "false";
+  ini["golfball"]["save"] = save ? "true" : "false";
+  ini["aruco"]["save"] = save ? "true" : "false";
+  cam.setup();
+  golfball.setup();
+  aruco.setup();
+  //
+  std::vector<cv::String> images, png;
+  cv::glob(imageDir + "/*.jpg", images);
+  cv::glob(imageDir + "/*.png", png);
+  images.insert(images.end(), png.begin(), png.end());
+  std::sort(images.begin(), images.end());
+  printf("# %d images in %s, %d loops\n", (int)images.size(), imageDir.c_str(), loops);
+  std::map<std::string, UBenchResult> expected;
+  if (not update)
+    expected = readExpected(expectedName);
+  std::map<std::string, UBenchResult> results;
+  std::vector<std::string> order;
+  int regressions = 0;
+  int missing = 0;
+  std::set<std::string> runDetectors;
+  std::stringstream detectorList(detectors);
+  std::string d;
+  while (std::getline(detectorList, d, ','))
+    runDetectors.insert(d);
+  for (const cv::String & fn : images)
+  {
+    cv::Mat img = cv::imread(fn);
+    if (img.empty())
+      continue;
+    std::string name = fs::path(fn).filename().string();
+    for (const std::string & det : {"golfball", "hough", "aruco"})
+    {
+      if (runDetectors.count(det) == 0)
+        continue;
+      UBenchResult r;
+      for (int k = 0; k < loops; k++)
+      {
+        std::vector<int> pos = {0, 0};
+        UTime t("now");
+        if (det == "golfball")
+        { // whole image as ROI
+          std::vector<cv::Point> roi = {cv::Point(0, 0), cv::Point(img.cols - 1, 0),
+                                        cv::Point(img.cols - 1, img.rows - 1), cv::Point(0, img.rows - 1)};
+          r.found = golfball.findGolfball(pos, roi, &img);
+          addTiming(det, golfball.timing);
+        }
+        else if (det == "hough")
+        {
+          r.found = golfball.findGolfballHough(pos, &img);
+          addTiming(det, golfball.timing);
+        }
+        else
+        {
+          // images are unrelated, so no tracking from the previous image
+          aruco.resetTrack();
+          int n = aruco.findAruco(arucoSize, false, &img);
+          r.found = n > 0;
+          r.ids = aruco.IDs;
+          r.ids.resize(n);
+          std::sort(r.ids.begin(), r.ids.end());
+          if (n > 0)
+          { // first marker position (m) in robot coordinates
+            r.x = aruco.pos_m[0][0];
+            r.y = aruco.pos_m[0][1];
+          }
+          addTiming(det, aruco.timing);
+        }
+        r.ms += t.getTimePassed() * 1000;
+        if (det != "aruco" and r.found)
+        {
+          r.x = pos[0];
+          r.y = pos[1];
+        }
+      }
+      r.ms /= loops;
+      std::string key = name + " " + det;
+      results[key] = r;
+      order.push_back(key);
+      std::string diff = "new";
+      auto e = expected.find(key);
+      if (e != expected.end())
+      {
+        diff = compare(r, e->second, det == "aruco" ? arucoTolerance : tolerance);
+        if (not diff.empty())
+          regressions++;
+      }
+      else
+        missing++;
+      printf("%-40s %-8s %d %7.1f %7.1f %7.2f ms %s\n", name.c_str(), det.c_str(), r.found, r.x, r.y, r.ms,
+             diff.empty() ? "OK" : diff.c_str());
+    }
+  }
+  // timing per stage
+  printf("# %-8s %-12s %8s %8s %6s\n", "detector", "stage", "mean ms", "max ms", "n");
+  for (auto & ds : stageStats)
+  {
+    for (UStageStat & s : ds.second)
+      printf("  %-8s %-12s %8.3f %8.3f %6d\n", ds.first.c_str(), s.name.c_str(), s.sum / s.n, s.max, s.n);
+  }
+  if (update)
+  { // save as expected results
+    FILE * f = fopen(expectedName.c_str(), "w");
+    if (f != nullptr)
+    {
+      fprintf(f, "%% raubase vision benchmark expected results\n");
+      fprintf(f, "%% image detector found x y [marker IDs]\n");
+      for (const std::string & key : order)
+      {
+        UBenchResult & r = results[key];
+        fprintf(f, "%s %d %g %g", key.c_str(), r.found, r.x, r.y);
+        for (int id : r.ids)
+          fprintf(f, " %d", id);
+        fprintf(f, "\n");
+      }
+      fclose(f);
+      printf("# expected results saved to %s\n", expectedName.c_str());
+    }
+  }
+  else
+    printf("# %d results, %d regressions, %d not in %s\n", (int)order.size(), regressions, missing,
+           expectedName.c_str());
+  // stop camera thread
+  service.stop = true;
+  aruco.terminate();
+  golfball.terminate();
+  cam.terminate();
+  return regressions > 0 ? 1 : 0;
+}
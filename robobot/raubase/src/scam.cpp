@@ -39,6 +39,13 @@
 UCam cam;
 namespace fs = std::filesystem;
 
+/// time now in microseconds since 1970, for timestamps shared by threads
+static int64_t nowUs()
+{
+  UTime t("now");
+  return int64_t(t.getSec()) * 1000000 + t.getMicrosec();
+}
+
 void UCam::setup()
 { // ensure default values
   if (not ini.has("camera"))
@@ -57,13 +64,76 @@ void UCam::setup()
     ini["camera"]["pos"] = "0.11 0 0.23";
     ini["camera"]["cam_tilt"] = "0.01";
   }
+  if (not ini["camera"].has("backend"))
+  { // 'opencv' (cv::VideoCapture) or 'v4l2' (direct, with driver frame time)
+    ini["camera"]["backend"] = "opencv";
+    ini["camera"]["v4l2_buffers"] = "2";
+  }
+  if (not ini["camera"].has("record"))
+  { // recording of camera frames (backend v4l2) and playback (backend playback)
+    ini["camera"]["record"] = "false";
+    ini["camera"]["record_path"] = "recordings";
+    ini["camera"]["playback_file"] = "recordings/run.mjr";
+    ini["camera"]["playback_realtime"] = "true";
+    ini["camera"]["playback_loop"] = "false";
+  }
+  if (not ini["camera"].has("shm"))
+  { // all frames in a POSIX shared memory ring (/dev/shm), for other processes
+    ini["camera"]["shm"] = "false";
+    ini["camera"]["shm_name"] = "/raubase_frames";
+    ini["camera"]["shm_slots"] = "4";
+    ini["camera"]["; shm_format jpeg (as received, not with backend opencv) or bgr"] = "";
+    ini["camera"]["shm_format"] = "jpeg";
+  }
+  if (not ini["camera"].has("calib_threads"))
+  { // calibration from saved images, 0 threads is one per CPU core
+    ini["camera"]["calib_threads"] = "0";
+    ini["camera"]["; find chessboard at reduced size, then refine at full size"] = "";
+    ini["camera"]["calib_detect_scale"] = "0.5";
+    ini["camera"]["calib_annotate"] = "false";
+  }
+  if (not ini["camera"].has("calib_width"))
+  { // image size used for calibration (camera matrix)
+    ini["camera"]["calib_width"] = ini["camera"]["width"];
+    ini["camera"]["calib_height"] = ini["camera"]["height"];
+    ini["camera"]["fourcc"] = "MJPG";
+    ini["camera"]["; exposure in 100us units and gain, -1 is automatic"] = "";
+    ini["camera"]["exposure"] = "-1";
+    ini["camera"]["gain"] = "-1";
+  }
+  if (not ini.has("camera_fast"))
+  { // camera profiles for cam.switchProfile("name"),
+    // values not in the profile are taken from [camera]
+    ini["camera_fast"]["; keep aspect ratio of calibration"] = "";
+    ini["camera_fast"]["width"] = "640";
+    ini["camera_fast"]["height"] = "360";
+    ini["camera_fast"]["fps"] = "60";
+    ini["camera_fast"]["exposure"] = "100";
+    ini["camera_full"]["width"] = "1280";
+    ini["camera_full"]["height"] = "720";
+    ini["camera_full"]["fps"] = "25";
+  }
+  if (not ini["camera"].has("floor_lut_step"))
+  { // pixel to floor lookup table grid step (pixels)
+    ini["camera"]["floor_lut_step"] = "4";
+  }
+  if (not ini["camera"].has("lazy"))
+  { // open camera when frames are needed (or pre-warm is requested),
+    // and close when not used for some time
+    ini["camera"]["lazy"] = "false";
+    ini["camera"]["idle_timeout"] = "15";
+  }
+  if (not ini["camera"].has("capture"))
+  { // false: calibration only, no camera thread (e.g. offline tools)
+    ini["camera"]["capture"] = "true";
+  }
   if (ini["camera"]["enabled"] == "true")
   { // create directory for images
     fs::create_directory(ini["camera"]["imagepath"]);
     //
     // create log file
     toConsole = ini["camera"]["print"] == "true";
-    int device = strtol(ini["camera"]["device"].c_str(), nullptr, 10);
+    device = strtol(ini["camera"]["device"].c_str(), nullptr, 10);
     // Camera matrix
     const char * p1 = ini["camera"]["matrix"].c_str();
     cameraMatrix = cv::Mat(3,3, CV_64F);
@@ -87,20 +157,14 @@ void UCam::setup()
     double st = sin(tilt);
     double ct = cos(tilt);
     // generate 4x4 transformation matrix (homogene coordinates)
-    matCtoR = cv::Mat::eye(4,4,CV_64F);
-    matCtoR.at<double>(0,0) = ct;
-    matCtoR.at<double>(0,2) = st;
-    matCtoR.at<double>(0,3) = pos[0];
-    matCtoR.at<double>(1,3) = pos[1];
-    matCtoR.at<double>(2,0) = -st;
-    matCtoR.at<double>(2,2) = ct;
-    matCtoR.at<double>(2,3) = pos[2];
+    matCtoR = cv::Matx44d(ct,  0, st, pos[0],
+                           0,  1,  0, pos[1],
+                         -st,  0, ct, pos[2],
+                           0,  0,  0, 1);
     // rotation only (3x3) from cam to robot
-    rotCtoR = cv::Mat::eye(3,3,CV_64F);
-    rotCtoR.at<double>(0,0) = ct;
-    rotCtoR.at<double>(0,2) = st;
-    rotCtoR.at<double>(2,0) = -st;
-    rotCtoR.at<double>(2,2) = ct;
+    rotCtoR = cv::Matx33d(ct,  0, st,
+                           0,  1,  0,
+                         -st,  0, ct);
     //
     if (ini["camera"]["log"] == "true")
     { // open logfile
@@ -112,12 +176,127 @@ void UCam::setup()
       fprintf(logfile, "%% 1 \tTime (sec)\n");
       fprintf(logfile, "%% 2 \tInformation\n");
     }
+    cache.setRectifier([this](const cv::Mat & raw, cv::Mat & rec){ rectify(raw, rec); });
     toLog("Camera matrix (from robot.ini)", ini["camera"]["matrix"].c_str());
     toLog("Distortion vector (from robot.ini)", ini["camera"]["distortion"].c_str());
-    // prepare to open camera
-    int apiID = cv::CAP_V4L2;  //cv::CAP_ANY;  // 0 = autodetect default API
-    // open selected camera using selected API
-    cap.open(device, apiID);
+    floorLutStep = strtol(ini["camera"]["floor_lut_step"].c_str(), nullptr, 10);
+    if (floorLutStep < 1)
+      floorLutStep = 1;
+    useV4l2 = ini["camera"]["backend"] == "v4l2";
+    usePlayback = ini["camera"]["backend"] == "playback";
+    recordOnOpen = ini["camera"]["record"] == "true" and useV4l2;
+    // camera matrix is for this resolution, and is scaled for other profiles
+    calibMatrix = cameraMatrix.clone();
+    calibSize = cv::Size(strtol(ini["camera"]["calib_width"].c_str(), nullptr, 10),
+                         strtol(ini["camera"]["calib_height"].c_str(), nullptr, 10));
+    lazy = ini["camera"]["lazy"] == "true";
+    idleTimeout = strtof(ini["camera"]["idle_timeout"].c_str(), nullptr);
+    // calibration is ready, also with the camera closed
+    loadProfile("default", camProfile);
+    imageSize = cv::Size(camProfile.width, camProfile.height);
+    scaleCameraMatrix(imageSize);
+    // make undistortion maps and log the time saved
+    timeUndistort(imageSize);
+    if (ini["camera"]["shm"] == "true")
+    { // shared frames, camera is then kept open
+      shmJpeg = ini["camera"]["shm_format"] == "jpeg" and (useV4l2 or usePlayback);
+      int slots = strtol(ini["camera"]["shm_slots"].c_str(), nullptr, 10);
+      size_t bytes = maxProfileImageBytes();
+      bool ok = shm.open(ini["camera"]["shm_name"], slots, bytes);
+      const int MSL = 200;
+      char s[MSL];
+      snprintf(s, MSL, "%s, %d slots of %zu bytes, format %s", ini["camera"]["shm_name"].c_str(),
+               slots, bytes, shmJpeg ? "jpeg" : "bgr");
+      toLog(ok ? "Frames to shared memory" : "Shared memory failed", s);
+    }
+    enabled = true;
+    // start camera thread, it opens the camera when needed
+    if (ini["camera"]["capture"] != "false")
+      th1 = new std::thread(runObj, this);
+  }
+  else
+    printf("# UCam:: disabled in robot.ini\n");
+}
+
+size_t UCam::maxProfileImageBytes()
+{
+  size_t bytes = camProfile.width * camProfile.height * 3;
+  for (auto & it : ini)
+  {
+    if (it.first.rfind("camera_", 0) != 0)
+      continue;
+    UCamProfile p;
+    if (loadProfile(it.first.substr(7), p))
+      bytes = std::max(bytes, size_t(p.width * p.height * 3));
+  }
+  return bytes;
+}
+
+bool UCam::loadProfile(std::string name, UCamProfile & profile)
+{
+  std::string section = "camera_" + name;
+  if (name != "default" and not ini.has(section))
+  {
+    printf("# UCam::loadProfile: no camera profile [%s] in robot.ini\n", section.c_str());
+    return false;
+  }
+  // get value from profile, or from [camera] if not in profile
+  auto value = [&](const char * key) -> std::string
+  {
+    if (name != "default" and ini[section].has(key))
+      return ini[section][key];
+    return ini["camera"][key];
+  };
+  profile.name = name;
+  profile.width = strtol(value("width").c_str(), nullptr, 10);
+  profile.height = strtol(value("height").c_str(), nullptr, 10);
+  profile.fps = strtof(value("fps").c_str(), nullptr);
+  profile.fourcc = value("fourcc");
+  profile.exposure = strtol(value("exposure").c_str(), nullptr, 10);
+  profile.gain = strtol(value("gain").c_str(), nullptr, 10);
+  return true;
+}
+
+bool UCam::openCamera(UCamProfile & p)
+{ // must be called with camLock locked (or from setup)
+  const int MSL = 200;
+  char s[MSL];
+  if (usePlayback)
+  { // recorded frames, image size is as recorded
+    const std::string & fn = ini["camera"]["playback_file"];
+    if (player.isOpen() or
+        player.open(fn, ini["camera"]["playback_realtime"] != "false",
+                    ini["camera"]["playback_loop"] == "true"))
+    {
+      snprintf(s, MSL, "# Playback of %s: width=%d, height=%d, %d frames",
+               fn.c_str(), player.width, player.height, player.count());
+      imageSize = cv::Size(player.width, player.height);
+    }
+    else
+      printf("# UCam - could not open recording %s\n", fn.c_str());
+  }
+  else if (useV4l2)
+  { // direct V4L2 with driver timestamps, MJPEG only
+    int nbuf = strtol(ini["camera"]["v4l2_buffers"].c_str(), nullptr, 10);
+    v4l.close();
+    if (v4l.open(device, p.width, p.height, p.fps, nbuf))
+    {
+      v4l.setExposure(p.exposure, p.gain);
+      snprintf(s, MSL, "# Video device %d (V4L2): width=%d, height=%d, format=MJPG, FPS=%g, buffers=%d",
+               device, v4l.width, v4l.height, v4l.fps, v4l.bufferCount);
+      imageSize = cv::Size(v4l.width, v4l.height);
+    }
+    else
+      printf("# UCam - camera could not open (V4L2)\n");
+  }
+  else
+  { // prepare to open camera
+    if (not cap.isOpened())
+    {
+      int apiID = cv::CAP_V4L2;  //cv::CAP_ANY;  // 0 = autodetect default API
+      // open selected camera using selected API
+      cap.open(device, apiID);
+    }
     // check if we succeeded
     //
     if (not cap.isOpened())
@@ -125,42 +304,107 @@ void UCam::setup()
       printf("# UCam - camera could not open\n");
     }
     else
-    {
-      uint32_t fourcc = cv::VideoWriter::fourcc('M','J','P','G');
-      cap.set(cv::CAP_PROP_FOURCC, fourcc);
+    { // a running camera is restarted by the driver, if size is changed
+      const char * cc = p.fourcc.c_str();
+      if (p.fourcc.size() == 4)
+        cap.set(cv::CAP_PROP_FOURCC, cv::VideoWriter::fourcc(cc[0], cc[1], cc[2], cc[3]));
       // possible resolutions in JPEG coding
       // (rows x columns) 320x640 or 720x1280
-      int w = strtol(ini["camera"]["width"].c_str(), nullptr, 0);
-      int h = strtol(ini["camera"]["height"].c_str(), nullptr, 0);
-      toLog("Width", ini["camera"]["width"].c_str());
-      toLog("Width", ini["camera"]["height"].c_str());
-      cap.set(cv::CAP_PROP_FRAME_HEIGHT, h);
-      cap.set(cv::CAP_PROP_FRAME_WIDTH, w);
-      int fps = strtol(ini["camera"]["fps"].c_str(), nullptr, 0);
-      cap.set(cv::CAP_PROP_FPS, fps);
+      cap.set(cv::CAP_PROP_FRAME_HEIGHT, p.height);
+      cap.set(cv::CAP_PROP_FRAME_WIDTH, p.width);
+      cap.set(cv::CAP_PROP_FPS, p.fps);
+      if (p.exposure >= 0)
+      { // V4L2: 1 = manual, 3 = aperture priority (auto)
+        cap.set(cv::CAP_PROP_AUTO_EXPOSURE, 1);
+        cap.set(cv::CAP_PROP_EXPOSURE, p.exposure);
+      }
+      else
+        cap.set(cv::CAP_PROP_AUTO_EXPOSURE, 3);
+      if (p.gain >= 0)
+        cap.set(cv::CAP_PROP_GAIN, p.gain);
       union FourChar
       {
         uint32_t cc4;
         char ccc[4];
       } fmt;
       fmt.cc4 = cap.get(cv::CAP_PROP_FOURCC);
-      const int MSL = 200;
-      char s[MSL];
       snprintf(s, MSL, "# Video device %d: width=%g, height=%g, format=%c%c%c%c, FPS=%g",
              device,
              cap.get(cv::CAP_PROP_FRAME_WIDTH),
              cap.get(cv::CAP_PROP_FRAME_HEIGHT),
              fmt.ccc[0], fmt.ccc[1], fmt.ccc[2], fmt.ccc[3],
              cap.get(cv::CAP_PROP_FPS));
-      printf("%s\n", s);
-      toLog(s);
+      imageSize = cv::Size(cap.get(cv::CAP_PROP_FRAME_WIDTH), cap.get(cv::CAP_PROP_FRAME_HEIGHT));
     }
-    if (cap.isOpened())
-      // start capturing images
-      th1 = new std::thread(runObj, this);
   }
-  else
-    printf("# UCam:: disabled in robot.ini\n");
+  camOpen = deviceOpen();
+  if (camOpen)
+  {
+    printf("%s\n", s);
+    toLog(s);
+    camProfile = p;
+    scaleCameraMatrix(imageSize);
+  }
+  return camOpen;
+}
+
+void UCam::scaleCameraMatrix(cv::Size size)
+{ // from calibration resolution to this, assuming same field of view
+  if (calibMatrix.empty() or calibSize.area() == 0 or size.area() == 0)
+    return;
+  double sx = double(size.width) / calibSize.width;
+  double sy = double(size.height) / calibSize.height;
+  cv::Mat m = calibMatrix.clone();
+  m.at<double>(0,0) *= sx;
+  m.at<double>(0,1) *= sx;
+  m.at<double>(0,2) = (m.at<double>(0,2) + 0.5) * sx - 0.5;
+  m.at<double>(1,1) *= sy;
+  m.at<double>(1,2) = (m.at<double>(1,2) + 0.5) * sy - 0.5;
+  // undistortion maps and floor table are rebuilt on next use
+  std::lock_guard<std::mutex> lock1(mapLock);
+  std::lock_guard<std::mutex> lock2(floorLock);
+  // in place (same 3x3 buffer), as detectors use it without a lock
+  m.copyTo(cameraMatrix);
+}
+
+bool UCam::switchProfile(std::string name)
+{
+  UCamProfile p;
+  if (not loadProfile(name, p))
+    return false;
+  if (name == camProfile.name)
+    return true;
+  if (not isOpen())
+  { // used when camera is opened
+    std::lock_guard<std::mutex> lock(camLock);
+    camProfile = p;
+    imageSize = cv::Size(p.width, p.height);
+    scaleCameraMatrix(imageSize);
+    toLog("Camera profile (camera closed)", name.c_str());
+    return true;
+  }
+  UTime t("now");
+  bool ok;
+  {
+    std::lock_guard<std::mutex> lock(camLock);
+    ok = openCamera(p);
+    // old frames have the old size
+    frames.clear();
+    // a few frames to settle exposure
+    frameCnt = 0;
+    settleFrames = 2;
+  }
+  float openMs = t.getTimePassed() * 1000;
+  UFrame f;
+  bool gotFrame = ok and waitNextFrame(f, 2.0);
+  const int MSL = 200;
+  char s[MSL];
+  snprintf(s, MSL, "# UCam:: switched to profile '%s' (%dx%d, %g fps): set in %.1f ms, first frame after %.1f ms%s",
+           name.c_str(), p.width, p.height, p.fps, openMs, t.getTimePassed() * 1000,
+           gotFrame ? "" : " (no frame)");
+  printf("%s\n", s);
+  toLog(s);
+  return gotFrame;
 }
 
 void UCam::terminate()
@@ -170,9 +414,17 @@ void UCam::terminate()
     th1->join();
     th1 = nullptr;
   }
+  // remove the shared frames (readers keep their mapping)
+  shm.close();
   // close logfile
   if (logfile != nullptr)
   {
+    fprintf(logfile, "%% frame cache: %d frames, %d shared uses\n", cache.frames, cache.hits);
+    if (shm.published > 0)
+      fprintf(logfile, "%% shared memory %s: %d frames, %d too large\n", shm.name.c_str(),
+              shm.published, shm.tooLarge);
+    fprintf(logfile, "%% rectified image buffers: %d frames, %d allocations, %.0f bytes allocated per frame\n",
+            pool.frames, pool.allocations, pool.bytesPerFrame());
     fclose(logfile);
     logfile = nullptr;
     printf("# UCam:: logfile closed\n");
@@ -180,65 +432,355 @@ void UCam::terminate()
 }
 
 
+void UCam::prewarm(float holdSec)
+{
+  prewarmUntilUs = nowUs() + int64_t(holdSec * 1e6);
+  if (not isOpen())
+    toLog("Pre-warm requested");
+}
+
+void UCam::setDecodeScale(const std::string & user, int scale, bool gray)
+{
+  std::lock_guard<std::mutex> lock(scaleLock);
+  if (scale <= 0)
+    decodeScales.erase(user);
+  else
+    decodeScales[user] = std::make_pair(scale, gray);
+  bool full = decodeScales.empty();
+  for (auto & ds : decodeScales)
+    full |= ds.second.first <= 1 and not ds.second.second;
+  if (full != decodeFull)
+  {
+    decodeFull = full;
+    const int MSL = 100;
+    char s[MSL];
+    snprintf(s, MSL, "(%s scale %d%s)", user.c_str(), scale, gray ? " gray" : "");
+    toLog(full ? "Camera decodes full frames" : "Frames decoded by users", s);
+  }
+}
+
+bool UCam::ensureOpen(float timeoutSec)
+{
+  if (isOpen())
+    return true;
+  if (not enabled or th1 == nullptr)
+    return false;
+  setFrameWanted();
+  openRequest = true;
+  std::unique_lock<std::mutex> lock(openLock);
+  openCv.wait_for(lock, std::chrono::microseconds(int64_t(timeoutSec * 1e6)),
+                  [this]{ return isOpen() or service.stop or stopCam; });
+  return isOpen();
+}
+
+void UCam::setFrameWanted()
+{
+  frameWantedUs = nowUs();
+}
+
+float UCam::frameWantedAge()
+{
+  return (nowUs() - frameWantedUs) * 1e-6;
+}
+
+bool UCam::startCamera()
+{
+  UTime t("now");
+  std::lock_guard<std::mutex> lock(camLock);
+  frameCnt = 0;
+  // no illumination to settle in a recording
+  settleFrames = usePlayback ? 0 : 10;
+  bool ok = openCamera(camProfile);
+  const int MSL = 100;
+  char s[MSL];
+  snprintf(s, MSL, "in %.1f ms", t.getTimePassed() * 1000);
+  toLog(ok ? "Camera opened" : "Camera open failed", s);
+  if (ok)
+  { // warm-up ends with first usable frame
+    warmUpStart = t;
+    warmingUp = true;
+    printf("# Camera is running (to stabilize illumination)\n");
+    if (recordOnOpen and not recorder.isOpen())
+      openRecording("");
+  }
+  return ok;
+}
+
+bool UCam::openRecording(std::string filename)
+{ // camLock must be locked
+  if (not useV4l2)
+  {
+    toLog("Recording needs camera backend v4l2");
+    return false;
+  }
+  if (filename.empty())
+  {
+    fs::create_directory(ini["camera"]["record_path"]);
+    UTime t("now");
+    filename = ini["camera"]["record_path"] + "/run_" + t.getForFilename() + ".mjr";
+  }
+  bool ok = recorder.open(filename, imageSize.width, imageSize.height);
+  toLog(ok ? "Recording to" : "Recording failed", filename.c_str());
+  return ok;
+}
+
+void UCam::closeRecording()
+{ // camLock must be locked
+  if (not recorder.isOpen())
+    return;
+  recorder.close();
+  const int MSL = 300;
+  char s[MSL];
+  snprintf(s, MSL, "%s: %d frames, %d dropped, %.1f MB", recorder.filename.c_str(),
+           recorder.frames, recorder.dropped, recorder.bytes / 1e6);
+  toLog("Recording closed", s);
+}
+
+bool UCam::startRecording(std::string filename)
+{
+  std::lock_guard<std::mutex> lock(camLock);
+  return openRecording(filename);
+}
+
+void UCam::stopRecording()
+{
+  std::lock_guard<std::mutex> lock(camLock);
+  closeRecording();
+}
+
+bool UCam::seekPlayback(UTime t)
+{
+  std::lock_guard<std::mutex> lock(camLock);
+  if (not player.isOpen())
+    return false;
+  bool ok = player.seek(t);
+  const int MSL = 100;
+  char s[MSL];
+  snprintf(s, MSL, "%lu.%04ld, now at frame %d of %d", t.getSec(), t.getMicrosec()/100,
+           player.next, player.count());
+  toLog(ok ? "Playback seek to" : "Playback seek failed", s);
+  return ok;
+}
+
+void UCam::publishShm(UTime & t, cv::Mat & decoded)
+{ // camLock must be locked
+  bool ok;
+  if (shmJpeg)
+  { // as received, no decode
+    cv::Mat jp = usePlayback ? player.jpeg() : v4l.jpeg();
+    int w = usePlayback ? player.width : v4l.width;
+    int h = usePlayback ? player.height : v4l.height;
+    ok = shm.publish(++shmSeq, t, UShmRing::MJPEG, w, h, 0, jp.data, jp.total());
+  }
+  else
+  {
+    if (decoded.empty())
+    { // not decoded for own use
+      if (usePlayback)
+        player.retrieve(shmImg);
+      else if (useV4l2)
+        v4l.retrieve(shmImg);
+      else
+        cap.retrieve(shmImg);
+      decoded = shmImg;
+    }
+    if (decoded.empty() or not decoded.isContinuous())
+      return;
+    UShmRing::Format f = decoded.channels() == 1 ? UShmRing::GRAY8 : UShmRing::BGR8;
+    ok = shm.publish(++shmSeq, t, f, decoded.cols, decoded.rows, decoded.step,
+                     decoded.data, decoded.total() * decoded.elemSize());
+  }
+  if (not ok and shm.tooLarge == 1)
+    toLog("Frame too large for shared memory slot");
+}
+
+void UCam::stopCamera()
+{
+  std::lock_guard<std::mutex> lock(camLock);
+  closeRecording();
+  camOpen = false;
+  cap.release();
+  v4l.close();
+  player.close();
+  frames.clear();
+}
+
 void UCam::run()
 {
-  printf("# Camera is running (to stabilize illumination)\n");
-  toLog("Camera open");
   while (not service.stop and not stopCam)
-  { // wait for reply
-    if (getNewFrame and not gotFrame and frameCnt > 10)
+  { // open camera when needed
+    if (not isOpen())
     {
-      cap.read(frame);
-      if (not frame.empty())
-      {
-        //printf("# UCam::run: read frame %d/%d\n", gotFrameCnt, frameCnt);
-        gotFrameCnt++;
-        imgTime.now();
-        getNewFrame = false;
-        gotFrame = true;
+      bool wanted = not lazy or openRequest or nowUs() < prewarmUntilUs or shm.isOpen();
+      if (not wanted)
+      { // nothing to do
+        usleep(20000);
+        continue;
+      }
+      openRequest = false;
+      bool opened = startCamera();
+      { // release users waiting in ensureOpen()
+        std::lock_guard<std::mutex> lock(openLock);
+      }
+      openCv.notify_all();
+      if (not opened)
+      { // try again later (if still wanted)
+        usleep(500000);
+        continue;
       }
     }
-    else
-    { // just mark as used to keep the buffer empty
-      cap.grab();
+    else if (lazy and frameWantedAge() > idleTimeout and
+             nowUs() > prewarmUntilUs and not openRequest and not shm.isOpen())
+    { // not used for a while
+      stopCamera();
+      toLog("Camera closed (idle)");
+      continue;
     }
-    frameCnt++;
+    // grab all frames to keep the camera queue empty
+    UTime t;
+    bool got;
+    { // camera settings may be changed between frames only
+      std::lock_guard<std::mutex> lock(camLock);
+      if (usePlayback)
+        // capture time is now, recorded time is in player
+        got = player.grab(t);
+      else if (useV4l2)
+        // capture time from driver
+        got = v4l.grab(t);
+      else
+      { // capture time (before decoding)
+        got = cap.grab();
+        t.now();
+      }
+      if (got)
+      {
+        frameCnt++;
+        if (recorder.isOpen())
+          // the frame as received, also when not decoded
+          recorder.add(v4l.jpeg(), frameCnt, t);
+        cv::Mat decoded;
+        // decode only when frames are in use, and
+        // not the first frames (to stabilize illumination)
+        if (frameCnt > settleFrames and frameWantedAge() < decodeHoldSec)
+        {
+          std::vector<uchar> & jpg = frames.writeJpeg();
+          cv::Mat & buf = frames.writeBuffer();
+          bool ok;
+          cv::Size sz;
+          if (useV4l2 or usePlayback)
+          { // keep the compressed frame, so that users can decode at reduced size
+            cv::Mat jp = usePlayback ? player.jpeg() : v4l.jpeg();
+            jpg.assign(jp.data, jp.data + jp.total());
+            if (usePlayback)
+              sz = cv::Size(player.width, player.height);
+            else
+              sz = cv::Size(v4l.width, v4l.height);
+            if (decodeFull)
+              ok = usePlayback ? player.retrieve(buf) : v4l.retrieve(buf);
+            else
+            { // decoded by the users
+              buf.release();
+              ok = not jpg.empty();
+            }
+          }
+          else
+          {
+            jpg.clear();
+            ok = cap.retrieve(buf);
+            sz = buf.size();
+          }
+          if (ok and not sz.empty())
+          {
+            decoded = buf;
+            frames.publish(t, sz);
+            if (warmingUp)
+            {
+              const int MSL = 100;
+              char s[MSL];
+              snprintf(s, MSL, "after %.1f ms (%d frames)", (t - warmUpStart) * 1000, frameCnt);
+              toLog("Camera warm-up, first frame", s);
+              warmingUp = false;
+            }
+          }
+        }
+        if (shm.isOpen() and frameCnt > settleFrames)
+          publishShm(t, decoded);
+      }
+    }
+    if (not got)
+      // no frame, don't hog the CPU
+      usleep(10000);
   }
   th1 = nullptr;
-  cap.release();
+  stopCamera();
+  { // no more frames, so release users waiting in ensureOpen()
+    std::lock_guard<std::mutex> lock(openLock);
+    stopCam = true;
+  }
+  openCv.notify_all();
   printf("# UCam::run: camera released\n");
 }
 
 
 cv::Mat UCam::getFrameRaw()
 { // request new frame
-  if (not cap.isOpened())
+  UFrame f;
+  if (waitNextFrame(f, 5.0))
   {
-    printf("# camera not open\n");
-    return frame;
+    imgTime = f.t;
+    if (f.img.empty())
+      // not decoded by camera thread
+      f.img = cache.get(f)->full();
   }
-//   printf("Asking for a frame\n");
-  getNewFrame = true;
-  // allow timeout, 1 second from now
-  UTime t;
-  t.now();
-  while (not gotFrame and t.getTimePassed() < 5.0)
-  { // wait for frame (or timeout of 1 second)
-    usleep(3000);
-  }
-  if (gotFrame)
-    ; // printf("# Got an image frame\n");
   else
     printf("# failed to get an image frame\n");
-  // mark finished with frame
-  gotFrame = false;
-  return frame;
+  return f.img;
+}
+
+bool UCam::getNewestFrame(UFrame & frame)
+{
+  if (not ensureOpen())
+  {
+    printf("# camera not open\n");
+    return false;
+  }
+  bool decoding = frameWantedAge() < decodeHoldSec;
+  setFrameWanted();
+  if (decoding and frames.getNewest(frame))
+    return true;
+  // newest frame may be old, so wait for a fresh one
+  return frames.waitNext(frame, 5.0);
+}
+
+bool UCam::waitNextFrame(UFrame & frame, float timeoutSec)
+{
+  if (not ensureOpen())
+  {
+    printf("# camera not open\n");
+    return false;
+  }
+  setFrameWanted();
+  return frames.waitNext(frame, timeoutSec);
+}
+
+bool UCam::waitFrameNewer(int seq, UFrame & frame, float timeoutSec)
+{
+  if (not ensureOpen())
+  {
+    printf("# camera not open\n");
+    return false;
+  }
+  if (frameWantedAge() >= decodeHoldSec)
+    // frames are not decoded, so the newest is too old
+    seq = max(seq, frames.getSeq());
+  setFrameWanted();
+  return frames.waitNewer(seq, frame, timeoutSec);
 }
 
 
 bool UCam::saveImage()
 {
-  if (not cap.isOpened())
+  if (not ensureOpen())
   {
     printf("# camera not open\n");
     return false;
@@ -270,7 +812,7 @@ bool UCam::saveImage()
     printf("# saved image to %s\n", s);
     // save also rectified image
     cv::Mat rec;
-    cv::undistort(rgb, rec, cameraMatrix, distCoeffs);
+    rectify(rgb, rec);
     // generate filename
     snprintf(s, MSL, "%s/img_rec_%s.jpg", ini["camera"]["imagepath"].c_str(), sfn_ptr);
     cv::imwrite(s, rec);
@@ -319,56 +861,107 @@ bool UCam::calibrate()
 
   cv::glob(path, images);
 
+  // corners are found in parallel, results are kept in image order
+  struct UCalibImage
+  {
+    bool success = false;
+    std::vector<cv::Point2f> corners;
+    cv::Size size;
+  };
+  std::vector<UCalibImage> found(images.size());
+  int threadCnt = strtol(ini["camera"]["calib_threads"].c_str(), nullptr, 10);
+  if (threadCnt <= 0)
+    threadCnt = std::max(1u, std::thread::hardware_concurrency());
+  threadCnt = std::min(threadCnt, std::max(1, (int)images.size()));
+  float detectScale = strtof(ini["camera"]["calib_detect_scale"].c_str(), nullptr);
+  if (detectScale <= 0.1 or detectScale > 1.0)
+    detectScale = 1.0;
+  bool annotate = ini["camera"]["calib_annotate"] == "true";
+  const cv::Size boardSize(CHECKERBOARD[0], CHECKERBOARD[1]);
+  std::atomic<int> nextImage{0};
+  int done = 0;
+  std::mutex progressLock;
+  UTime t0("now");
+  auto findCorners = [&]()
+  { // worker: take the next image until all are used
+    int i;
+    while ((i = nextImage++) < (int)images.size())
+    {
+      UTime t1("now");
+      UCalibImage & r = found[i];
+      // colour is needed for the annotated image only
+      cv::Mat frame, gray;
+      if (annotate)
+      {
+        frame = cv::imread(images[i]);
+        if (not frame.empty())
+          cv::cvtColor(frame, gray, cv::COLOR_BGR2GRAY);
+      }
+      else
+        gray = cv::imread(images[i], cv::IMREAD_GRAYSCALE);
+      if (not gray.empty())
+      {
+        r.size = gray.size();
+        const int flags = cv::CALIB_CB_ADAPTIVE_THRESH | cv::CALIB_CB_FAST_CHECK | cv::CALIB_CB_NORMALIZE_IMAGE;
+        if (detectScale < 1.0)
+        { // find the board in a reduced image, and refine at full resolution
+          cv::Mat small;
+          cv::resize(gray, small, cv::Size(), detectScale, detectScale, cv::INTER_AREA);
+          r.success = cv::findChessboardCorners(small, boardSize, r.corners, flags);
+          if (r.success)
+            for (cv::Point2f & c : r.corners)
+              c *= 1.0 / detectScale;
+        }
+        if (not r.success)
+          // Finding checker board corners
+          // If desired number of corners are found in the image then success = true
+          r.success = cv::findChessboardCorners(gray, boardSize, r.corners, flags);
+      }
+      if (r.success)
+      { // refining pixel coordinates for given 2d points.
+        cv::TermCriteria criteria(cv::TermCriteria::EPS | cv::TermCriteria::MAX_ITER, 30, 0.001);
+        cv::cornerSubPix(gray, r.corners, cv::Size(11,11), cv::Size(-1,-1), criteria);
+        if (annotate)
+        { // Displaying the detected corner points on the checker board,
+          // saved here (not by the image writer, that may drop images when busy)
+          cv::drawChessboardCorners(frame, boardSize, r.corners, r.success);
+          std::string name = fs::path(images[i]).stem().string();
+          cv::imwrite(ini["camera"]["imagepath"] + "/img_chessboardCorners_" + name + ".jpg", frame);
+        }
+      }
+      std::lock_guard<std::mutex> lock(progressLock);
+      done++;
+      printf("# %3d/%d %s %s (%.0f ms)\n", done, (int)images.size(),
+             r.success ? "corners found" : "no corners   ", images[i].c_str(),
+             t1.getTimePassed() * 1000);
+    }
+  };
+  std::vector<std::thread> workers;
+  for (int k = 0; k < threadCnt; k++)
+    workers.emplace_back(findCorners);
+  for (std::thread & w : workers)
+    w.join();
+  {
+    const int MSL = 200;
+    char s[MSL];
+    snprintf(s, MSL, "%d images in %.1f sec using %d threads, detect scale %g",
+             (int)images.size(), t0.getTimePassed(), threadCnt, detectScale);
+    toLog("Chessboard corners", s);
+    printf("# Chessboard corners: %s\n", s);
+  }
   std::vector<cv::String> okImages;
-  cv::Mat frame, gray;
-  // vector to store the pixel coordinates of detected checker board corners
-  std::vector<cv::Point2f> corner_pts;
-  bool success;
+  cv::Size calibImageSize;
   int j = 0;
-  // Looping over all the images in the directory
-  for(int i = 0; i < (int)images.size(); i++)
+  for (int i = 0; i < (int)images.size(); i++)
   {
-    frame = cv::imread(images[i]);
-    cv::cvtColor(frame,gray,cv::COLOR_BGR2GRAY);
-
-    // Finding checker board corners
-    // If desired number of corners are found in the image then success = true
-    success = cv::findChessboardCorners(gray,cv::Size(CHECKERBOARD[0],CHECKERBOARD[1]), corner_pts, cv::CALIB_CB_ADAPTIVE_THRESH | cv::CALIB_CB_FAST_CHECK | cv::CALIB_CB_NORMALIZE_IMAGE);
-
-    /*
-      * If desired number of corner are detected,
-      * we refine the pixel coordinates and display
-      * them on the images of checker board
-      */
-    if(success)
+    if (found[i].success)
     {
-      cv::TermCriteria criteria(cv::TermCriteria::EPS | cv::TermCriteria::MAX_ITER, 30, 0.001);
-
-      // refining pixel coordinates for given 2d points.
-      cv::cornerSubPix(gray,corner_pts,cv::Size(11,11), cv::Size(-1,-1),criteria);
-
-      // Displaying the detected corner points on the checker board
-      cv::drawChessboardCorners(frame, cv::Size(CHECKERBOARD[0],CHECKERBOARD[1]), corner_pts,success);
-
-      const int MSL = 500;
-      char sfn[MSL];
-      const char * sfn_ptr = sfn;
-      char s[MSL];
-      // Save draw chessboard corners
-      snprintf(s, MSL, "%s/img_chessboardCorners_%s_%d.jpg", ini["camera"]["imagepath"].c_str(), sfn_ptr,i);
-      // save
-      cv::imwrite(s, frame);
-
       objpoints.push_back(objp);
-      imgpoints.push_back(corner_pts);
-      printf("# %2d succes    %s\n", j++, images[i].c_str());
+      imgpoints.push_back(found[i].corners);
       okImages.push_back(images[i]);
+      calibImageSize = found[i].size;
+      j++;
     }
-    else
-      printf("#   no corners %s\n", images[i].c_str());
-
-//     cv::imshow("Image",frame);
-//     cv::waitKey(0);
   }
   // if needed
   cv::destroyAllWindows();
@@ -384,7 +977,7 @@ bool UCam::calibrate()
       * detected corners (imgpoints)
       */
     //std::cout << objpoints[0] << endl;
-    cv::calibrateCamera(objpoints, imgpoints,cv::Size(gray.rows,gray.cols),cameraMatrix,distCoeffs,rvecs,tvecs);
+    cv::calibrateCamera(objpoints, imgpoints, calibImageSize, cameraMatrix, distCoeffs, rvecs, tvecs);
     // show results
     for (int i = 0; i < cameraMatrix.rows; i++)
     {
@@ -409,6 +1002,11 @@ bool UCam::calibrate()
             cameraMatrix.at<double>(2,2));
     ini["camera"]["matrix"] = s;
     toLog("Camera matrix", s);
+    // calibrated at this resolution
+    calibMatrix = cameraMatrix.clone();
+    calibSize = calibImageSize;
+    ini["camera"]["calib_width"] = std::to_string(calibImageSize.width);
+    ini["camera"]["calib_height"] = std::to_string(calibImageSize.height);
     // also lens distortion
     snprintf(s, MSL, "%g %g %g %g %g",
             distCoeffs.at<double>(0,0),
@@ -487,20 +1085,114 @@ cv::Mat UCam::getFrame()
   cv::Mat raw;
   cv::Mat rectified;
   raw = getFrameRaw();
-  cv::undistort(raw, rectified, cameraMatrix, distCoeffs);
+  if (not raw.empty())
+  { // buffer is reused, when the caller has released the last frame
+    pool.newFrame();
+    rectified = pool.get(POOL_RECTIFIED, raw.size(), raw.type());
+    rectify(raw, rectified);
+  }
   // cv::imshow("Rectified image",rectified);
   // cv::waitKey(0);
   return rectified;
 }
 
+cv::Mat UCam::getFrame(cv::Rect roi)
+{
+  cv::Mat raw;
+  cv::Mat rectified;
+  raw = getFrameRaw();
+  if (not raw.empty())
+  {
+    pool.newFrame();
+    cv::Rect r = roi & cv::Rect(0, 0, raw.cols, raw.rows);
+    if (not r.empty())
+      rectified = pool.get(POOL_RECTIFIED_ROI, r.size(), raw.type());
+    rectify(raw, rectified, roi);
+  }
+  return rectified;
+}
+
+void UCam::rectify(const cv::Mat & raw, cv::Mat & rectified, cv::Rect roi)
+{
+  cv::Mat m1, m2;
+  { // get maps (rebuild if needed)
+    std::lock_guard<std::mutex> lock(mapLock);
+    if (not updateUndistortMaps(raw.size()))
+    {
+      rectified.release();
+      return;
+    }
+    // just the headers, the maps are not copied
+    m1 = undistMap1;
+    m2 = undistMap2;
+  }
+  if (roi.empty())
+    cv::remap(raw, rectified, m1, m2, cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+  else
+  { // only the requested part
+    roi &= cv::Rect(0, 0, raw.cols, raw.rows);
+    if (roi.empty())
+      rectified.release();
+    else
+      cv::remap(raw, rectified, m1(roi), m2(roi), cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+  }
+}
+
+bool UCam::updateUndistortMaps(cv::Size size)
+{ // must be called with mapLock locked
+  if (cameraMatrix.empty() or distCoeffs.empty() or size.area() == 0)
+    return false;
+  bool same = not undistMap1.empty() and
+              undistMap1.size() == size and
+              mapCameraMatrix.size() == cameraMatrix.size() and
+              mapDistCoeffs.size() == distCoeffs.size() and
+              cv::norm(cameraMatrix, mapCameraMatrix, cv::NORM_INF) == 0 and
+              cv::norm(distCoeffs, mapDistCoeffs, cv::NORM_INF) == 0;
+  if (not same)
+  { // (re)build fixed-point maps (same as cv::undistort uses internally)
+    UTime t("now");
+    cv::initUndistortRectifyMap(cameraMatrix, distCoeffs, cv::Mat(), cameraMatrix,
+                                size, CV_16SC2, undistMap1, undistMap2);
+    cameraMatrix.copyTo(mapCameraMatrix);
+    distCoeffs.copyTo(mapDistCoeffs);
+    const int MSL = 100;
+    char s[MSL];
+    snprintf(s, MSL, "%dx%d in %.1f ms", size.width, size.height, t.getTimePassed() * 1000);
+    toLog("Undistortion maps made", s);
+  }
+  return true;
+}
+
+void UCam::timeUndistort(cv::Size size)
+{
+  cv::Mat raw(size, CV_8UC3);
+  cv::randu(raw, cv::Scalar::all(0), cv::Scalar::all(255));
+  cv::Mat rec;
+  const int N = 3;
+  // the old way - maps calculated for every frame
+  UTime t("now");
+  for (int i = 0; i < N; i++)
+    cv::undistort(raw, rec, cameraMatrix, distCoeffs);
+  float tu = t.getTimePassed() / N;
+  // make maps once
+  rectify(raw, rec);
+  t.now();
+  for (int i = 0; i < N; i++)
+    rectify(raw, rec);
+  float tr = t.getTimePassed() / N;
+  const int MSL = 200;
+  char s[MSL];
+  snprintf(s, MSL, "# UCam:: rectify %dx%d: undistort %.1f ms, remap %.1f ms, saved %.1f ms per frame",
+           size.width, size.height, tu * 1000, tr * 1000, (tu - tr) * 1000);
+  printf("%s\n", s);
+  toLog(s);
+}
+
 // Checks if a matrix is a valid rotation matrix.
 bool UCam::isRotationMatrix(cv::Matx33d &rot)
 {
-  cv::Mat Rt;
-  cv::transpose(rot, Rt);
-  cv::Mat shouldBeIdentity = Rt * rot;
-  cv::Mat I = cv::Mat::eye(3,3, shouldBeIdentity.type());
-  return  cv::norm(I, shouldBeIdentity) < 1e-6;
+  cv::Matx33d shouldBeIdentity = rot.t() * rot;
+  return  cv::norm(shouldBeIdentity - cv::Matx33d::eye()) < 1e-6;
 }
 
 // Calculates rotation matrix to euler angles
@@ -509,6 +1201,11 @@ cv::Vec3d UCam::rotationMatrixToEulerAngles(cv::Matx33d &rot)
   if (not isRotationMatrix(rot))
     printf("Given rotation matrix is not a rotation matrix\n");
   //
+  return eulerAngles(rot);
+}
+
+cv::Vec3d UCam::eulerAngles(const cv::Matx33d &rot)
+{
   float sy = sqrt(rot(0,0)*rot(0,0) + rot(1,0)*rot(1,0));
   bool singular = sy < 1e-6;
   float x, y, z;
@@ -527,54 +1224,279 @@ cv::Vec3d UCam::rotationMatrixToEulerAngles(cv::Matx33d &rot)
   return cv::Vec3d(x, y, z);
 }
 
+cv::Matx33d UCam::rodriguesToMatrix(const cv::Vec3d & r)
+{ // as cv::Rodrigues, R = cos(t) I + (1 - cos(t)) k k' + sin(t) [k]x
+  double theta = sqrt(r.dot(r));
+  if (theta < 1e-12)
+    return cv::Matx33d::eye();
+  double c = cos(theta);
+  double s = sin(theta);
+  double c1 = 1.0 - c;
+  double x = r[0] / theta;
+  double y = r[1] / theta;
+  double z = r[2] / theta;
+  return cv::Matx33d(c + c1*x*x,   c1*x*y - s*z, c1*x*z + s*y,
+                     c1*x*y + s*z, c + c1*y*y,   c1*y*z - s*x,
+                     c1*x*z - s*y, c1*y*z + s*x, c + c1*z*z);
+}
+
 
 cv::Vec3d UCam::getOrientationInRobotEulerAngles(cv::Vec3d rodrigues, bool degrees)
 {
-  cv::Vec3d rh;
-  rh[0] =  rodrigues[2]; // robot x is forward, i.e. image z (z is distance away from cam)
-  rh[1] =  -rodrigues[0]; // robot y is left, i.e. image -x (image x is right)
-  rh[2] =  -rodrigues[1]; // robot z is up, i.e image -y (image y is down)
-  // convert to robot coordinates
-  cv::Mat rr = rotCtoR * rh;
-  // rotation is in Rodrigues coordinates (vector and rotation around this vector)
-  cv::Matx33d mrr;
-  cv::Rodrigues(rr, mrr);
-  cv::Vec3f re = rotationMatrixToEulerAngles(mrr);
-//   printf("# Euler angles in robot coordinates %dx%d (x,y,z) = (%g %g %g)\n",
-//          re.rows, re.cols,
-//          re[0], // roll
-//          re[1], // pitch
-//          re[2]); //yaw
-  // make angles more useful
-  // facing robot is angle (0,0,0)
-  re[0] *= -1.0; // for some reason
-  re[0] += M_PI;
-  if (re[0] > M_PI)
-    re[0] -= 2 * M_PI;
-  re[1] *= -1.0; // for some reason
-  re[2] += M_PI;
-  if (re[2] > M_PI)
-    re[2] -= 2 * M_PI;
-  if (degrees)
-    re *= 180.0/M_PI;
-  return re;
+  cv::Vec3d result;
+  getOrientationsInRobotEulerAngles(&rodrigues, &result, 1, degrees);
+  return result;
+}
+
+void UCam::getOrientationsInRobotEulerAngles(const cv::Vec3d * rodrigues, cv::Vec3d * euler, int n, bool degrees)
+{
+  for (int i = 0; i < n; i++)
+  {
+    const cv::Vec3d & r = rodrigues[i];
+    // robot x is forward, i.e. image z (z is distance away from cam)
+    // robot y is left, i.e. image -x (image x is right)
+    // robot z is up, i.e image -y (image y is down)
+    cv::Vec3d rh(r[2], -r[0], -r[1]);
+    // convert to robot coordinates
+    cv::Vec3d rr = rotCtoR * rh;
+    // rotation is in Rodrigues coordinates (vector and rotation around this vector)
+    // the matrix is a rotation matrix by construction, so no check
+    cv::Vec3f re = eulerAngles(rodriguesToMatrix(rr));
+    // make angles more useful
+    // facing robot is angle (0,0,0)
+    re[0] *= -1.0; // for some reason
+    re[0] += M_PI;
+    if (re[0] > M_PI)
+      re[0] -= 2 * M_PI;
+    re[1] *= -1.0; // for some reason
+    re[2] += M_PI;
+    if (re[2] > M_PI)
+      re[2] -= 2 * M_PI;
+    if (degrees)
+      re *= 180.0/M_PI;
+    euler[i] = re;
+  }
 }
 
 
 cv::Vec3d UCam::getPositionInRobotCoordinates(cv::Vec3d pos)
 {
-  cv::Vec4d ph;
-  ph[0] =  pos[2];  // robot x is forward, i.e. image z (z is distance away from cam)
-  ph[1] = -pos[0]; // robot y is left, i.e. image -x (image x is right)
-  ph[2] = -pos[1]; // robot z is up, i.e image -y (image y is down)
-  ph[3] = 1.0;
-  // convert to robot coordinates
-  cv::Mat pr = matCtoR * ph;
-  // reformat to result vector
-  cv::Vec3d result(pr.at<double>(0), pr.at<double>(1), pr.at<double>(2));
-  //
-  if (false)
-    printf("# pos in robot coordinates %dx%d (x,y,z,1) = (%g %g %g)\n",
-           pr.rows, pr.cols, result[0], result[1], result[2]);
+  cv::Vec3d result;
+  getPositionsInRobotCoordinates(&pos, &result, 1);
   return result;
 }
+
+void UCam::getPositionsInRobotCoordinates(const cv::Vec3d * pos, cv::Vec3d * robot, int n)
+{
+  for (int i = 0; i < n; i++)
+  {
+    const cv::Vec3d & p = pos[i];
+    // robot x is forward, i.e. image z (z is distance away from cam)
+    // robot y is left, i.e. image -x (image x is right)
+    // robot z is up, i.e image -y (image y is down)
+    cv::Vec4d pr = matCtoR * cv::Vec4d(p[2], -p[0], -p[1], 1.0);
+    robot[i] = cv::Vec3d(pr[0], pr[1], pr[2]);
+  }
+}
+
+void UCam::benchmarkGeometry(int n)
+{ // compare with the cv::Mat based conversion (as used before)
+  cv::Mat matLegacy(matCtoR);
+  cv::Mat rotLegacy(rotCtoR);
+  cv::RNG rng(42);
+  std::vector<cv::Vec3d> tvec(n), rvec(n);
+  for (int i = 0; i < n; i++)
+  {
+    tvec[i] = cv::Vec3d(rng.uniform(-0.5, 0.5), rng.uniform(-0.3, 0.3), rng.uniform(0.2, 2.0));
+    rvec[i] = cv::Vec3d(rng.uniform(-3.0, 3.0), rng.uniform(-3.0, 3.0), rng.uniform(-3.0, 3.0));
+  }
+  std::vector<cv::Vec3d> posOld(n), rotOld(n), posNew(n), rotNew(n);
+  UTime t("now");
+  for (int i = 0; i < n; i++)
+  {
+    cv::Vec4d ph(tvec[i][2], -tvec[i][0], -tvec[i][1], 1.0);
+    cv::Mat pr = matLegacy * ph;
+    posOld[i] = cv::Vec3d(pr.at<double>(0), pr.at<double>(1), pr.at<double>(2));
+  }
+  float tPosOld = t.getTimePassed();
+  t.now();
+  for (int i = 0; i < n; i++)
+  {
+    cv::Vec3d rh(rvec[i][2], -rvec[i][0], -rvec[i][1]);
+    cv::Mat rr = rotLegacy * rh;
+    cv::Matx33d mrr;
+    cv::Rodrigues(rr, mrr);
+    cv::Vec3f re = rotationMatrixToEulerAngles(mrr);
+    re[0] = -re[0] + M_PI;
+    if (re[0] > M_PI)
+      re[0] -= 2 * M_PI;
+    re[1] *= -1.0;
+    re[2] += M_PI;
+    if (re[2] > M_PI)
+      re[2] -= 2 * M_PI;
+    rotOld[i] = re;
+  }
+  float tRotOld = t.getTimePassed();
+  t.now();
+  getPositionsInRobotCoordinates(tvec.data(), posNew.data(), n);
+  float tPosNew = t.getTimePassed();
+  t.now();
+  getOrientationsInRobotEulerAngles(rvec.data(), rotNew.data(), n);
+  float tRotNew = t.getTimePassed();
+  double dPos = 0, dRot = 0;
+  for (int i = 0; i < n; i++)
+  {
+    dPos = fmax(dPos, cv::norm(posOld[i] - posNew[i]));
+    cv::Vec3d d = rotOld[i] - rotNew[i];
+    for (int j = 0; j < 3; j++)
+    { // same angle, if differ by 2 pi
+      d[j] = fabs(d[j]);
+      d[j] = fmin(d[j], fabs(d[j] - 2 * M_PI));
+    }
+    dRot = fmax(dRot, cv::norm(d));
+  }
+  const int MSL = 300;
+  char s[MSL];
+  snprintf(s, MSL, "# UCam:: geometry %d conversions: position %.3f us (was %.3f us), "
+           "orientation %.3f us (was %.3f us), max difference %.2g m, %.2g rad",
+           n, tPosNew * 1e6 / n, tPosOld * 1e6 / n, tRotNew * 1e6 / n, tRotOld * 1e6 / n, dPos, dRot);
+  printf("%s\n", s);
+  toLog(s);
+}
+
+
+bool UCam::getFloorPosition(cv::Point2f pixel, cv::Vec3d & floor, bool rectified, float height)
+{
+  if (not rectified)
+  { // use lookup table
+    std::lock_guard<std::mutex> lock(floorLock);
+    if (updateFloorLut())
+    {
+      cv::Vec3f ray;
+      if (lookupRay(pixel, ray))
+        return rayToFloor(ray, floor, height);
+    }
+  }
+  return floorAnalytic(pixel, floor, rectified, height);
+}
+
+bool UCam::floorAnalytic(cv::Point2f pixel, cv::Vec3d & floor, bool rectified, float height)
+{
+  cv::Point2d n; // normalized image position (z=1)
+  if (rectified)
+  {
+    n.x = (pixel.x - cameraMatrix.at<double>(0,2)) / cameraMatrix.at<double>(0,0);
+    n.y = (pixel.y - cameraMatrix.at<double>(1,2)) / cameraMatrix.at<double>(1,1);
+  }
+  else
+  { // remove lens distortion
+    std::vector<cv::Point2f> src = {pixel};
+    std::vector<cv::Point2f> dst;
+    cv::undistortPoints(src, dst, cameraMatrix, distCoeffs);
+    n = dst[0];
+  }
+  // ray from camera in robot coordinate directions (x=forward, y=left, z=up)
+  cv::Vec3d ray(1.0, -n.x, -n.y);
+  cv::Vec3d rr = rotCtoR * ray;
+  return rayToFloor(rr, floor, height);
+}
+
+int UCam::getFloorPositions(const std::vector<cv::Point2f> & pixels, std::vector<cv::Vec3d> & floor,
+                            std::vector<uchar> & valid, float height)
+{
+  floor.resize(pixels.size());
+  valid.assign(pixels.size(), 0);
+  int n = 0;
+  std::lock_guard<std::mutex> lock(floorLock);
+  bool lut = updateFloorLut();
+  for (int i = 0; i < (int)pixels.size(); i++)
+  {
+    cv::Vec3f ray;
+    if (lut and lookupRay(pixels[i], ray))
+      valid[i] = rayToFloor(ray, floor[i], height);
+    else
+      // outside image
+      valid[i] = floorAnalytic(pixels[i], floor[i], false, height);
+    if (valid[i])
+      n++;
+  }
+  return n;
+}
+
+bool UCam::rayToFloor(const cv::Vec3f & ray, cv::Vec3d & floor, float height)
+{
+  if (ray[2] > -1e-6)
+    // at or above horizon
+    return false;
+  // distance along ray to plane
+  double s = (height - pos[2]) / ray[2];
+  floor[0] = pos[0] + s * ray[0];
+  floor[1] = pos[1] + s * ray[1];
+  floor[2] = height;
+  return true;
+}
+
+bool UCam::lookupRay(cv::Point2f pixel, cv::Vec3f & ray)
+{ // must be called with floorLock locked
+  float gx = pixel.x / floorLutStep;
+  float gy = pixel.y / floorLutStep;
+  int ix = floorf(gx);
+  int iy = floorf(gy);
+  if (ix < 0 or iy < 0 or ix >= floorLut.cols - 1 or iy >= floorLut.rows - 1)
+    return false;
+  float fx = gx - ix;
+  float fy = gy - iy;
+  const cv::Vec3f * r0 = floorLut.ptr<cv::Vec3f>(iy) + ix;
+  const cv::Vec3f * r1 = floorLut.ptr<cv::Vec3f>(iy + 1) + ix;
+  // bilinear interpolation between the 4 grid rays
+  ray = (r0[0] * (1 - fx) + r0[1] * fx) * (1 - fy) + (r1[0] * (1 - fx) + r1[1] * fx) * fy;
+  return true;
+}
+
+bool UCam::updateFloorLut()
+{ // must be called with floorLock locked
+  if (cameraMatrix.empty() or distCoeffs.empty() or imageSize.area() == 0)
+    return false;
+  bool same = not floorLut.empty() and
+              floorLutSize == imageSize and
+              floorLutMadeStep == floorLutStep and
+              floorLutCameraMatrix.size() == cameraMatrix.size() and
+              floorLutDistCoeffs.size() == distCoeffs.size() and
+              floorLutRot == rotCtoR and
+              cv::norm(cameraMatrix, floorLutCameraMatrix, cv::NORM_INF) == 0 and
+              cv::norm(distCoeffs, floorLutDistCoeffs, cv::NORM_INF) == 0;
+  if (not same)
+  { // ray direction (robot coordinates) for a grid of raw pixels,
+    // the grid covers the full image
+    UTime t("now");
+    int nx = (imageSize.width + floorLutStep - 1) / floorLutStep + 1;
+    int ny = (imageSize.height + floorLutStep - 1) / floorLutStep + 1;
+    std::vector<cv::Point2f> src;
+    src.reserve(nx * ny);
+    for (int y = 0; y < ny; y++)
+      for (int x = 0; x < nx; x++)
+        src.push_back(cv::Point2f(x * floorLutStep, y * floorLutStep));
+    std::vector<cv::Point2f> dst;
+    cv::undistortPoints(src, dst, cameraMatrix, distCoeffs);
+    floorLut.create(ny, nx, CV_32FC3);
+    for (int y = 0; y < ny; y++)
+    {
+      cv::Vec3f * row = floorLut.ptr<cv::Vec3f>(y);
+      for (int x = 0; x < nx; x++)
+      {
+        const cv::Point2f & n = dst[y * nx + x];
+        row[x] = rotCtoR * cv::Vec3d(1.0, -n.x, -n.y);
+      }
+    }
+    floorLutSize = imageSize;
+    floorLutMadeStep = floorLutStep;
+    floorLutRot = rotCtoR;
+    cameraMatrix.copyTo(floorLutCameraMatrix);
+    distCoeffs.copyTo(floorLutDistCoeffs);
+    const int MSL = 100;
+    char s[MSL];
+    snprintf(s, MSL, "%dx%d grid (step %d) in %.1f ms", nx, ny, floorLutStep, t.getTimePassed() * 1000);
+    toLog("Floor lookup table made", s);
+  }
+  return true;
+}
@@ -25,11 +25,21 @@
 
 #include <unistd.h>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <map>
 #include <opencv2/core.hpp>
 #include <opencv2/videoio.hpp>
 #include <opencv2/highgui.hpp>
 
 #include "utime.h"
+#include "uframe.h"
+#include "uv4l2.h"
+#include "umjpegfile.h"
+#include "ushmring.h"
+#include "umatpool.h"
+#include "uframecache.h"
 
 using namespace std;
 
@@ -56,11 +66,43 @@ public:
   /**
    * Calibrate */
   bool calibrate();
-  // get the newest frame
+  // get the next frame (captured after this call)
   cv::Mat getFrameRaw();
+  /**
+   * Get the newest frame without waiting.
+   * Waits for a new frame only if frames were not in use recently.
+   * \returns false if no frame is available */
+  bool getNewestFrame(UFrame & frame);
+  /**
+   * Wait for the next frame, i.e. captured after this call.
+   * \returns false on timeout */
+  bool waitNextFrame(UFrame & frame, float timeoutSec = 5.0);
+  /**
+   * Wait for a frame newer than the frame with sequence number 'seq'.
+   * Returns at once, if there is a newer frame already.
+   * \returns false on timeout */
+  bool waitFrameNewer(int seq, UFrame & frame, float timeoutSec = 5.0);
   // get the newest frame rectified
   // using parameters in regbot.ini
   cv::Mat getFrame();
+  /**
+   * Get the newest frame rectified, but only this region.
+   * \param roi is the wanted region (in rectified pixel coordinates),
+   * \returns an image of roi size (empty if roi is outside image). */
+  cv::Mat getFrame(cv::Rect roi);
+  /**
+   * Rectify (remove lens distortion) from a raw image.
+   * Uses undistortion maps that are rebuilt if
+   * camera matrix, distortion or image size is changed.
+   * \param raw is the source image (from getFrameRaw()).
+   * \param rectified is the destination image.
+   * \param roi if not empty, then only this part of the rectified image is made. */
+  void rectify(const cv::Mat & raw, cv::Mat & rectified, cv::Rect roi = cv::Rect());
+  /**
+   * Derived images (rectified, gray, blurred, HSV, reduced) for the newest frames.
+   * Use cache.get(frame) to get the images for a frame,
+   * so that detectors using the same frame share the conversions. */
+  UFrameCache cache;
   /**
    * Camera matrix (3x3) */
   cv::Mat cameraMatrix;
@@ -71,12 +113,12 @@ public:
   /**
    * Rotation and translation matrix (4x4) from camera-centred coordinates to robot coordinates
    * - all coordinates as is used by robots, i.e x=forward, y=left and z=up) */
-  cv::Mat matCtoR;
+  cv::Matx44d matCtoR = cv::Matx44d::eye();
   /**
    * Rotation matrix (3x3) from camera-centred coordinates to robot coordinates.
    * Note: include pitch angle only.
    * - all coordinates as is used by robots, i.e. x=forward, y=left and z=up) */
-  cv::Mat rotCtoR;
+  cv::Matx33d rotCtoR = cv::Matx33d::eye();
   /**
    * Convert this position in camera coordinates to robot coordinates.
    * \param pos is in camera coordinates (x = right, y=down, z=forward)
@@ -86,6 +128,12 @@ public:
    * \returns position in robot coordinates using camera position and pitch
    *          robot coordinates are (x = forward, y=left, z=up). */
   cv::Vec3d getPositionInRobotCoordinates(cv::Vec3d pos);
+  /**
+   * Convert n positions in camera coordinates to robot coordinates (as above).
+   * Uses no heap allocation.
+   * \param pos is array of n positions in camera coordinates.
+   * \param robot is array for the n results. */
+  void getPositionsInRobotCoordinates(const cv::Vec3d * pos, cv::Vec3d * robot, int n);
   /**
    * Convert this orientation in Rodrigues coordinates to euler angles in robot coordinates
    * \param pos Rodrigues coordinates (vector and rotation) in camera coordinates  (x=right, y=down, z=forward)-
@@ -93,6 +141,81 @@ public:
    * \returns rotation around robot coordinate axes (right hand rules).
    *          Robot coordinates are (x = forward, y=left, z=up). */
   cv::Vec3d getOrientationInRobotEulerAngles(cv::Vec3d rodrigues, bool degrees = false);
+  /**
+   * Convert n orientations in Rodrigues coordinates to robot euler angles (as above).
+   * Uses no heap allocation.
+   * \param rodrigues is array of n orientations in camera coordinates.
+   * \param euler is array for the n results. */
+  void getOrientationsInRobotEulerAngles(const cv::Vec3d * rodrigues, cv::Vec3d * euler, int n, bool degrees = false);
+  /**
+   * Compare time and result of the geometry conversions
+   * with the cv::Mat based versions, result is printed and logged.
+   * \param n is number of (random) conversions */
+  void benchmarkGeometry(int n = 10000);
+  /**
+   * Find the position on a horizontal plane (e.g. the floor)
+   * seen in this image pixel.
+   * \param pixel is the image position (x=right, y=down) in pixels.
+   * \param floor is set to position in robot coordinates (x = forward, y=left, z=up).
+   * \param rectified should be true if the pixel is from a rectified image (from getFrame()),
+   *        else the lens distortion is removed first.
+   * \param height is the height of the plane above the floor (e.g. radius of a ball).
+   * \returns false if the pixel is at or above the horizon (floor position is then unchanged). */
+  bool getFloorPosition(cv::Point2f pixel, cv::Vec3d & floor, bool rectified = false, float height = 0.0);
+  /**
+   * Switch to a camera profile from robot.ini section [camera_<name>],
+   * e.g. switchProfile("fast"), or "default" for the [camera] values.
+   * Sets resolution, frame rate, format and exposure/gain. The camera
+   * matrix is scaled from the calibration resolution, undistortion
+   * maps and floor table follow. The time used is logged.
+   * \returns true if a frame is received with the new profile. */
+  bool switchProfile(std::string name);
+  /**
+   * Name of the active camera profile */
+  std::string getProfile()
+  {
+    return camProfile.name;
+  }
+  /**
+   * Open the camera now (if closed), as frames will be needed soon.
+   * The camera is kept open at least for this time.
+   * \param holdSec is the minimum time to keep camera open. */
+  void prewarm(float holdSec = 10.0);
+  /**
+   * Declare the image scale a frame user (detector) needs.
+   * The camera thread decodes full colour frames only if a user needs these
+   * (or no user has declared anything), otherwise the frames hold the JPEG data,
+   * and are decoded by the user at the scale needed (see UFrameImages::decoded()).
+   * With backend v4l2 or playback only, else frames are always decoded.
+   * \param user is a name for the user, e.g. "aruco"
+   * \param scale is 1 (full size), 2, 4 or 8, or 0 if not in use anymore
+   * \param gray is true if luma is enough */
+  void setDecodeScale(const std::string & user, int scale, bool gray = false);
+  /**
+   * Record the camera frames as received (MJPEG, not re-encoded)
+   * with time and sequence index. Needs backend=v4l2.
+   * \param filename if empty, then a timestamped file in camera/record_path.
+   * \returns false if not possible */
+  bool startRecording(std::string filename = "");
+  /**
+   * Stop recording (remaining frames and index are written) */
+  void stopRecording();
+  /**
+   * With backend=playback: continue from the first frame recorded
+   * at or after this time.
+   * \returns false if not playing or time is after the recording */
+  bool seekPlayback(UTime t);
+  /**
+   * Find the floor position for a number of raw image pixels.
+   * Uses a lookup table (a ray for every floor_lut_step pixel) made from camera matrix,
+   * distortion, tilt and position, rebuilt when any of these change.
+   * \param pixels are the raw (not rectified) image positions.
+   * \param floor is set to the positions in robot coordinates (same count as pixels).
+   * \param valid is set to 1 for pixels below the horizon, else 0.
+   * \param height is the height of the plane above the floor.
+   * \returns number of valid floor positions. */
+  int getFloorPositions(const std::vector<cv::Point2f> & pixels, std::vector<cv::Vec3d> & floor,
+                        std::vector<uchar> & valid, float height = 0.0);
 
   /**
    * from https://learnopencv.com/rotation-matrix-to-euler-angles/
@@ -102,12 +225,80 @@ public:
    * from https://learnopencv.com/rotation-matrix-to-euler-angles/
    * */
    cv::Vec3d rotationMatrixToEulerAngles(cv::Matx33d &rot);
+  /**
+   * Euler angles (x,y,z) from a rotation matrix (no check) */
+  static cv::Vec3d eulerAngles(const cv::Matx33d &rot);
+  /**
+   * Rotation matrix from Rodrigues vector (as cv::Rodrigues, but no allocation) */
+  static cv::Matx33d rodriguesToMatrix(const cv::Vec3d & r);
 
 
 private:
   void toLog(const char * pre, const char * post = "");
+  /**
+   * Rebuild undistortion maps if needed (matrix, distortion or size changed)
+   * \returns true if maps are OK for this size */
+  bool updateUndistortMaps(cv::Size size);
+  /**
+   * Log time used by cv::undistort versus remap with maps (per frame) */
+  void timeUndistort(cv::Size size);
   bool toConsole = false;
   FILE * logfile = nullptr;
+  /// camera settings for a mission phase
+  struct UCamProfile
+  {
+    std::string name;
+    int width, height;
+    float fps;
+    std::string fourcc;
+    /// exposure (100us units) and gain, -1 is automatic
+    int exposure, gain;
+  };
+  /**
+   * Get profile from robot.ini, missing values from [camera] */
+  bool loadProfile(std::string name, UCamProfile & profile);
+  /**
+   * Open (or change) camera with these settings
+   * \returns true if open */
+  bool openCamera(UCamProfile & p);
+  /**
+   * Scale calibrated camera matrix to this image size */
+  void scaleCameraMatrix(cv::Size size);
+  /**
+   * Request camera to open (if closed) and wait until open
+   * \returns false if camera is disabled or fails to open */
+  bool ensureOpen(float timeoutSec = 5.0);
+  /**
+   * Open or close camera (from camera thread) */
+  bool startCamera();
+  void stopCamera();
+  /**
+   * Open and close recorder, camLock must be locked */
+  bool openRecording(std::string filename);
+  void closeRecording();
+  int device = 0;
+  UCamProfile camProfile;
+  /// camera enabled in robot.ini
+  bool enabled = false;
+  /// open on demand, close when idle
+  bool lazy = false;
+  float idleTimeout = 15;
+  /// keep camera open until this time (microseconds since 1970),
+  /// set by mission thread
+  std::atomic<int64_t> prewarmUntilUs{0};
+  std::atomic<bool> openRequest{false};
+  /// signalled by camera thread when camera is opened (or fails to open)
+  std::condition_variable openCv;
+  std::mutex openLock;
+  /// time of camera open, until first frame
+  UTime warmUpStart;
+  bool warmingUp = false;
+  cv::Mat calibMatrix;
+  cv::Size calibSize;
+  /// used by camera thread while capturing, and when changing settings
+  std::mutex camLock;
+  /// frames to skip after start (illumination)
+  int settleFrames = 10;
   cv::Vec3d pos;
   double tilt;
   //
@@ -116,13 +307,98 @@ private:
     // transfer to the class run() function.
     obj->run();
   }
+  /**
+   * Is camera open (either backend), camLock must be locked */
+  bool deviceOpen()
+  {
+    return cap.isOpened() or v4l.isOpen() or player.isOpen();
+  }
+  /// camera open state, set with camLock locked, for use from any thread
+  std::atomic<bool> camOpen{false};
+  bool isOpen()
+  {
+    return camOpen;
+  }
   // camera
-  cv::Mat frame;
   cv::VideoCapture cap;
+  /// direct V4L2 capture (if backend=v4l2 in robot.ini)
+  UV4l2 v4l;
+  bool useV4l2 = false;
+  /// recorded frames in place of camera (if backend=playback in robot.ini)
+  UMjpegPlayer player;
+  bool usePlayback = false;
+  /// run recording
+  UMjpegRecorder recorder;
+  /// start recording when camera is opened
+  bool recordOnOpen = false;
+  /// all frames to shared memory for other processes (e.g. Python vision)
+  UShmRing shm;
+  /// publish the compressed frame (else BGR)
+  bool shmJpeg = true;
+  /// sequence of frames in shared memory (frames are not always decoded,
+  /// so this differs from UFrame::seq), use capture time to match frames
+  uint64_t shmSeq = 0;
+  /// decoded for shared memory only
+  cv::Mat shmImg;
+  /**
+   * Copy this frame to shared memory, camLock must be locked.
+   * \param decoded is the decoded frame, if decoded already */
+  void publishShm(UTime & t, cv::Mat & decoded);
+  /**
+   * Largest image (bytes) from any camera profile, used to size shared memory slots */
+  size_t maxProfileImageBytes();
   int frameCnt = 0;
-  int gotFrameCnt = 0;
-  bool getNewFrame = false;
-  bool gotFrame = false;
+  /// the newest decoded frames
+  UFrameStore frames;
+  /// last time a frame was requested (microseconds since 1970),
+  /// set by any user thread, frames are decoded only when in use
+  std::atomic<int64_t> frameWantedUs{0};
+  /**
+   * Mark that a frame is requested now */
+  void setFrameWanted();
+  /**
+   * \returns seconds since a frame was last requested */
+  float frameWantedAge();
+  const float decodeHoldSec = 2.0;
+  /// scale and colour needed by each frame user
+  std::map<std::string, std::pair<int, bool>> decodeScales;
+  std::mutex scaleLock;
+  /// full colour decode in camera thread
+  std::atomic<bool> decodeFull{true};
+  // undistortion maps (fixed point) and the values used to make them
+  std::mutex mapLock;
+  cv::Mat undistMap1, undistMap2;
+  cv::Mat mapCameraMatrix, mapDistCoeffs;
+  /**
+   * Rebuild pixel to floor lookup table if needed,
+   * must be called with floorLock locked.
+   * \returns true if table is usable */
+  bool updateFloorLut();
+  /**
+   * Get ray direction (robot coordinates) for a raw pixel
+   * from the lookup table (bilinear interpolation).
+   * \returns false if the pixel is outside the table */
+  bool lookupRay(cv::Point2f pixel, cv::Vec3f & ray);
+  /**
+   * Intersection of a ray from the camera with a horizontal plane
+   * \returns false if the ray is at or above the horizon */
+  bool rayToFloor(const cv::Vec3f & ray, cv::Vec3d & floor, float height);
+  /**
+   * Floor position without lookup table (as getFloorPosition(...)) */
+  bool floorAnalytic(cv::Point2f pixel, cv::Vec3d & floor, bool rectified, float height);
+  /// image size (from camera)
+  cv::Size imageSize;
+  /// pixel to floor lookup table (ray for each grid point)
+  std::mutex floorLock;
+  cv::Mat floorLut;
+  int floorLutStep = 4;
+  int floorLutMadeStep = 0;
+  cv::Size floorLutSize;
+  cv::Matx33d floorLutRot;
+  cv::Mat floorLutCameraMatrix, floorLutDistCoeffs;
+  /// buffers for rectified images
+  UMatPool pool;
+  enum PoolStage {POOL_RECTIFIED, POOL_RECTIFIED_ROI};
   // support variables
   std::thread * th1 = nullptr;
   bool stopCam = false;
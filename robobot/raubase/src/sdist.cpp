@@ -44,6 +44,11 @@ void SIrDist::setup()
     ini["dist"]["sensor1"] = "sharp"; // alternatives "sharp" or "URM09"
     ini["dist"]["sensor2"] = "sharp"; // alternatives "sharp" or "URM09"
   }
+  if (not ini["dist"].has("history"))
+  { // number of samples saved for time lookup
+    ini["dist"]["history"] = "100";
+  }
+  history.setup(strtol(ini["dist"]["history"].c_str(), nullptr, 10));
   // use values and subscribe to source data
   // like teensy1.send("sub pose 4\n");
   std::string c13 = ini["dist"]["ir13cm"];
@@ -119,6 +124,10 @@ bool SIrDist::decode(const char* msg, UTime & msgTime)
       dist[0] = distAD[0] * urm09factor;
     if (sensortype[1] == URM09)
       dist[1] = distAD[1] * urm09factor;
+    UDistSample ds;
+    ds.dist[0] = dist[0];
+    ds.dist[1] = dist[1];
+    history.add(updTime, ds);
     // notify users of a new update
     updateCnt++;
     // save to log_encoder_pose
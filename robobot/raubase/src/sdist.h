@@ -26,6 +26,22 @@
 
 
 #include "utime.h"
+#include "uhistory.h"
+
+/**
+ * One distance sensor sample for the history */
+class UDistSample
+{
+public:
+  float dist[2] = {0};
+  static UDistSample interpolate(const UDistSample & a, const UDistSample & b, float f)
+  {
+    UDistSample r;
+    for (int i = 0; i < 2; i++)
+      r.dist[i] = a.dist[i] + f * (b.dist[i] - a.dist[i]);
+    return r;
+  }
+};
 
 /**
  * Class to receive the IR (sharp 2Y0A21) sensor
@@ -57,6 +73,8 @@ public:
   float urm09factor;
   enum sensortypes {sharp, URM09};
   sensortypes sensortype[2];
+  /// distance history (size from robot.ini)
+  UHistory<UDistSample> history;
 
 public:
 //   mutex dataLock; // ensure consistency
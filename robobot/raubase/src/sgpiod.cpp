@@ -26,9 +26,13 @@
 #include <string.h>
 #include <unistd.h>
 #include <chrono>
+#include <math.h>
+#include <time.h>
+#include <sys/epoll.h>
 #include <thread>
 #include <iostream>
 #include "uservice.h"
+#include "ureactor.h"
 #include "sgpiod.h"
 
 // inspired from https://github.com/brgl/libgpiod/blob/master/bindings/cxx/gpiod.hpp
@@ -50,6 +54,12 @@ void SGpiod::setup()
     ini["gpio"]["log"] = "true";
     ini["gpio"]["print"] = "false";
   }
+  if (not ini["gpio"].has("debounce_ms"))
+  { // input pins are read on edge events, then ignored for this time
+    ini["gpio"]["debounce_ms"] = "5";
+  }
+  debounce = strtof(ini["gpio"]["debounce_ms"].c_str(), nullptr) / 1000.0;
+  stopOnStop = ini["gpio"]["stop_on_stop"] == "true";
   chip = gpiod_chip_open_by_name(chipname);
   if (chip != nullptr)
   { // set output ports
@@ -102,24 +112,20 @@ void SGpiod::setup()
       }
       else
       {
-        // default is input
+        // default is input, with edge events
         err = -1;
         while (err == -1)
         {
-          err = gpiod_line_request_input(pins[i], "raubase_in");
+          err = gpiod_line_request_both_edges_events(pins[i], "raubase_in");
           if (err == -1)
             usleep(3333);
-          else
-          {
-            err = gpiod_line_set_flags(pins[i], GPIOD_LINE_REQUEST_FLAG_BIAS_PULL_DOWN);
-            if (err != 0)
-              printf("#SGpio:: set line pull-down failed\n");
-          }
           if (loop++ > 10)
           { // failed to rerserve GPIO
             printf("# SGpio:: *********** failed to reserve GPIO pin %d\n", pinNumber[i]);
+            break;
           }
         }
+        in_pinuse[i] = err == 0;
       }
     }
   }
@@ -145,15 +151,49 @@ void SGpiod::setup()
     fprintf(logfile, "%% 7 \tPin %d\n", pinNumber[5]);
     fprintf(logfile, "%% 8 \tPin %d\n", pinNumber[6]);
   }
-  if (not service.stop)
-    // start listen to the keyboard
-    th1 = new std::thread(runObj, this);
+  if (not service.stop and chip != nullptr)
+  { // react to edge events in reactor thread
+    UTime t("now");
+    bool pv[MAX_PINS];
+    for (int i = 0; i < MAX_PINS; i++)
+    {
+      pv[i] = readPin(pinNumber[i]);
+      if (not in_pinuse[i])
+        continue;
+      // value at start (no event for this)
+      in_pin_value[i] = pv[i];
+      const int MSL = 30;
+      char s[MSL];
+      snprintf(s, MSL, "gpio pin %d", pinNumber[i]);
+      reactor.addFd(gpiod_line_event_get_fd(pins[i]), EPOLLIN, s,
+                    [this, i](uint32_t /*events*/){ readEvents(i); });
+    }
+    toLog(pv, t);
+  }
 }
 
 void SGpiod::terminate()
 {
-  if (th1 != nullptr)
-    th1->join();
+  if (chip != nullptr)
+  {
+    for (int i = 0; i < MAX_PINS; i++)
+    {
+      if (in_pinuse[i])
+        reactor.removeFd(gpiod_line_event_get_fd(pins[i]));
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(pinLock);
+    for (int i = 0; i < MAX_PINS; i++)
+    {
+      if (recheckTimer[i] >= 0)
+        reactor.removeTimer(recheckTimer[i]);
+      recheckTimer[i] = -1;
+    }
+    // release any waiting
+    stopping = true;
+  }
+  pinChanged.notify_all();
   if (logfile != nullptr)
   {
     fclose(logfile);
@@ -223,56 +263,173 @@ void SGpiod::setPin(const int pin, bool value)
 }
 
 
-void SGpiod::run()
+void SGpiod::readEvents(int idx)
 {
-  bool pv[MAX_PINS] = {false};
-  bool changed = true;
-  int loop = 0;
-  bool stopSwitchPressed = false;
-  auto sampleTime =  1ms;
-  auto loopTime = std::chrono::steady_clock::now() + sampleTime;
-  while (not service.stop and chip != nullptr)
+  const int MEC = 16;
+  gpiod_line_event ev[MEC];
+  // all waiting events
+  int n = gpiod_line_event_read_multiple(pins[idx], ev, MEC);
+  for (int e = 0; e < n; e++)
   {
-    loop++;
-    changed = false;
-    for (int i = 0; i < MAX_PINS; i++)
-    {
-      pv[i] = readPin(pinNumber[i]);
-      if (loop < 100)
-        // make sure we don't detect a power-on event (first 100ms)
-        in_pin_value[i] = pv[i];
-      else if (pv[i] != in_pin_value[i])
-      {
-        in_pin_value[i] = pv[i];
-        changed = true;
-        // debug
-        // printf("# SGpio:: pin %d(%d) changed (%d)\n",
-        //        i, pinNumber[i], pv[i]);
-        // debug end
-        if (i == 0 and
-            pv[i]==1 and
-            ini["gpio"]["stop_on_stop"] == "true")
-        { // stop switch
-          stopSwitchPressed = true;
-        }
-      }
+    UTime t = eventTime(ev[e].ts);
+    gotEdge(idx, ev[e].event_type == GPIOD_LINE_EVENT_RISING_EDGE, t);
+  }
+}
+
+void SGpiod::gotEdge(int idx, int value, UTime & t)
+{
+  bool stopSwitch = false;
+  {
+    std::lock_guard<std::mutex> lock(pinLock);
+    UTime last = risingTime[idx];
+    if (fallingTime[idx] > last)
+      last = fallingTime[idx];
+    float dt = t - last;
+    if (dt < debounce)
+    { // contact bounce, use the value after the debounce time
+      if (recheckTimer[idx] < 0)
+        recheckTimer[idx] = reactor.addTimer(0, "gpio debounce",
+                                             [this, idx](){ recheck(idx); }, debounce - dt);
     }
-    if (changed or loop %20 == 0)
-      toLog(pv);
-    // terminate app
-    if (stopSwitchPressed)
-    {
-      service.stopNow("stop_switch");
-      stopSwitchPressed = false;
+    else if (value != in_pin_value[idx])
+      stopSwitch = accept(idx, value, t);
+  }
+  if (stopSwitch)
+    service.stopNow("stop_switch");
+}
+
+void SGpiod::recheck(int idx)
+{
+  bool stopSwitch = false;
+  {
+    std::lock_guard<std::mutex> lock(pinLock);
+    // timer is removed after this call
+    recheckTimer[idx] = -1;
+    int v = gpiod_line_get_value(pins[idx]);
+    if (v >= 0 and v != in_pin_value[idx])
+    { // settled at a new value
+      UTime t("now");
+      stopSwitch = accept(idx, v, t);
     }
-    //
-    std::this_thread::sleep_until(loopTime);
-    loopTime += sampleTime;
   }
+  if (stopSwitch)
+    service.stopNow("stop_switch");
+}
+
+bool SGpiod::accept(int idx, int value, UTime & t)
+{ // pinLock is locked
+  in_pin_value[idx] = value;
+  if (value)
+  {
+    risingCnt[idx]++;
+    risingTime[idx] = t;
+  }
+  else
+  {
+    fallingCnt[idx]++;
+    fallingTime[idx] = t;
+  }
+  pinChanged.notify_all();
+  bool pv[MAX_PINS];
+  for (int i = 0; i < MAX_PINS; i++)
+  {
+    if (in_pinuse[i])
+      pv[i] = in_pin_value[i];
+    else
+      pv[i] = readPin(pinNumber[i]);
+  }
+  toLog(pv, t);
+  // stop switch
+  return idx == 0 and value == 1 and stopOnStop;
+}
+
+UTime SGpiod::eventTime(const timespec & ts)
+{
+  UTime now("now");
+  UTime t;
+  double tsSec = ts.tv_sec + ts.tv_nsec * 1e-9;
+  double nowSec = now.getSec() + now.getMicrosec() * 1e-6;
+  if (fabs(nowSec - tsSec) < 3600)
+    // realtime clock (kernel before 5.7)
+    t.setTime(ts.tv_sec, ts.tv_nsec / 1000);
+  else
+  { // monotonic clock, so back from now
+    timespec mono;
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    float age = (mono.tv_sec - ts.tv_sec) + (mono.tv_nsec - ts.tv_nsec) * 1e-9;
+    t = now;
+    t -= age;
+  }
+  return t;
+}
+
+int SGpiod::getPin(int pin, UTime * changeTime)
+{
+  int idx = getPinIndex(pin);
+  if (idx < 0 or not in_pinuse[idx])
+    return -1;
+  std::lock_guard<std::mutex> lock(pinLock);
+  if (changeTime != nullptr)
+  {
+    *changeTime = risingTime[idx];
+    if (fallingTime[idx] > *changeTime)
+      *changeTime = fallingTime[idx];
+  }
+  return in_pin_value[idx];
+}
+
+int SGpiod::waitForEdge(int pin, int edge, float timeoutSec, UTime * edgeTime)
+{
+  int idx = getPinIndex(pin);
+  if (idx < 0 or not in_pinuse[idx])
+  {
+    printf("# SGpiod::waitForEdge: pin %d is not an input pin\n", pin);
+    return -1;
+  }
+  std::unique_lock<std::mutex> lock(pinLock);
+  int rc = risingCnt[idx];
+  int fc = fallingCnt[idx];
+  auto edgeSeen = [&]()
+  {
+    bool rising = risingCnt[idx] != rc;
+    bool falling = fallingCnt[idx] != fc;
+    return stopping or
+           (edge != 0 and rising) or
+           (edge != 1 and falling);
+  };
+  if (timeoutSec <= 0)
+    pinChanged.wait(lock, edgeSeen);
+  else if (not pinChanged.wait_for(lock, std::chrono::microseconds(long(timeoutSec * 1e6)), edgeSeen))
+    return -1;
+  if (stopping)
+    return -1;
+  int value;
+  if (edge == 1 or (edge == -1 and risingCnt[idx] != rc and
+                    (fallingCnt[idx] == fc or risingTime[idx] > fallingTime[idx])))
+    value = 1;
+  else
+    value = 0;
+  if (edgeTime != nullptr)
+    *edgeTime = value ? risingTime[idx] : fallingTime[idx];
+  return value;
 }
 
 int SGpiod::wait4Pin(int pin, uint timeout_ms, int wait4Value)
 {
+  int idx = getPinIndex(pin);
+  if (idx >= 0 and in_pinuse[idx])
+  { // debounced input, wait for edge event
+    std::unique_lock<std::mutex> lock(pinLock);
+    auto hasValue = [&]{ return stopping or in_pin_value[idx] == wait4Value; };
+    if (timeout_ms == 0)
+      pinChanged.wait(lock, hasValue);
+    else
+      pinChanged.wait_for(lock, std::chrono::milliseconds(timeout_ms), hasValue);
+    if (in_pin_value[idx] == wait4Value)
+      return wait4Value;
+    return -1;
+  }
+  // output pin
   int value = -1;
   UTime t("now");
   while (true and chip != nullptr)
@@ -292,11 +449,10 @@ int SGpiod::wait4Pin(int pin, uint timeout_ms, int wait4Value)
   return value;
 }
 
-void SGpiod::toLog(bool pv[])
+void SGpiod::toLog(bool pv[], UTime & t)
 { // pv is pin-value
   if (service.stop)
     return;
-  UTime t("now");
   if (logfile != nullptr)
   {
     fprintf(logfile,"%lu.%04ld %d %d %d %d %d %d %d\n",
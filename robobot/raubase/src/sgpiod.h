@@ -25,6 +25,8 @@
 #define SGPIOD_H
 
 #include <gpiod.h>
+#include <mutex>
+#include <condition_variable>
 #include "utime.h"
 
 
@@ -55,15 +57,27 @@ public:
    * \param pin is one of 13, 6, 12, 16, 19, 26, 21, 20 */
   void setPin(const int pin, bool value);
   /**
-   * Wait for pin to be high or low
+   * Wait for pin to be high or low (debounced value for input pins),
+   * returns at once, if the pin has this value already.
    * \param pin - pin to wait for
-   * \param timeout - value in ms, 0= wait forever
+   * \param timeout - value in ms, 0= wait forever for an input pin
+   *                  (released at terminate), output pins are checked once
    * \param wait4Value 1 (default), 0 wait for pin to be low.
    * \return the pin value or -1 on timeout. */
   int wait4Pin(int pin, uint timeout_ms, int wait4Value = 1);
   /**
-  * to listen to pins */
-  void run();
+   * Wait for the next (debounced) edge on an input pin.
+   * \param pin - input pin to wait for
+   * \param edge 1 = rising, 0 = falling, -1 = either
+   * \param timeoutSec max wait time, 0 = wait forever
+   * \param edgeTime if not nullptr, then set to the time of the edge (from the kernel)
+   * \return the pin value after the edge, or -1 on timeout or not an input pin. */
+  int waitForEdge(int pin, int edge = 1, float timeoutSec = 0, UTime * edgeTime = nullptr);
+  /**
+   * Debounced value of an input pin.
+   * \param changeTime if not nullptr, then set to the time of the last change
+   * \returns -1 if not an input pin */
+  int getPin(int pin, UTime * changeTime = nullptr);
 
 protected:
   int getPinIndex(int pinNumber);
@@ -85,17 +99,41 @@ private:
   FILE * logfile = nullptr;
 
 private:
-  static void runObj(SGpiod * obj)
-  { // called, when thread is started
-      // transfer to the class run() function.
-      obj->run();
-  }
   /**
    * Save pin values to log when there is a change
-   * \param pv is an array of current pin values */
-  void toLog(bool pv[]);
-  //
-  std::thread * th1;
+   * \param pv is an array of current pin values
+   * \param t is the time of the change */
+  void toLog(bool pv[], UTime & t);
+  /**
+   * Read edge events from input pin (called by the reactor) */
+  void readEvents(int idx);
+  /**
+   * An edge (from kernel) on input pin, debounce and use */
+  void gotEdge(int idx, int value, UTime & t);
+  /**
+   * Pin value after debounce time (one-shot reactor timer) */
+  void recheck(int idx);
+  /**
+   * New debounced pin value, pinLock must be locked
+   * \returns true if this is the stop switch */
+  bool accept(int idx, int value, UTime & t);
+  /**
+   * Convert kernel event time (monotonic or realtime clock) to UTime */
+  UTime eventTime(const timespec & ts);
+  bool in_pinuse[MAX_PINS] = {false};
+  /// edge counts and time of last edge
+  int risingCnt[MAX_PINS] = {0};
+  int fallingCnt[MAX_PINS] = {0};
+  UTime risingTime[MAX_PINS];
+  UTime fallingTime[MAX_PINS];
+  /// pending debounce check
+  int recheckTimer[MAX_PINS] = {-1, -1, -1, -1, -1, -1, -1};
+  /// ignore edges for this time after a change (seconds)
+  float debounce = 0.005;
+  bool stopOnStop = true;
+  bool stopping = false;
+  std::mutex pinLock;
+  std::condition_variable pinChanged;
 };
 
 /**
@@ -41,6 +41,13 @@ void SImu::setup()
     ini["imu"]["print_gyro"] = "false";
     ini["imu"]["print_acc"] = "false";
   }
+  if (not ini["imu"].has("history"))
+  { // number of samples saved for time lookup
+    ini["imu"]["history"] = "400";
+  }
+  int hn = strtol(ini["imu"]["history"].c_str(), nullptr, 10);
+  gyroHistory.setup(hn);
+  accHistory.setup(hn);
   // use values and subscribe to source data
   // like teensy1.send("sub pose 4\n");
   std::string s = "sub gyro0 " + ini["imu"]["rate_ms"] + "\n";
@@ -104,6 +111,10 @@ bool SImu::decode(const char* msg, UTime & msgTime)
     acc[0] = strtof(p1, (char**)&p1);
     acc[1] = strtof(p1, (char**)&p1);
     acc[2] = strtof(p1, (char**)&p1);
+    UImuSample is;
+    for (int i = 0; i < 3; i++)
+      is.v[i] = acc[i];
+    accHistory.add(updTimeAcc, is);
     // notify users of a new update
     updateCnt++;
     // save to log
@@ -119,6 +130,10 @@ bool SImu::decode(const char* msg, UTime & msgTime)
     gyro[0] = strtof(p1, (char**)&p1);
     gyro[1] = strtof(p1, (char**)&p1);
     gyro[2] = strtof(p1, (char**)&p1);
+    UImuSample is;
+    for (int i = 0; i < 3; i++)
+      is.v[i] = gyro[i];
+    gyroHistory.add(updTime, is);
     // notify users of a new update
     updateCnt++;
     // save to log
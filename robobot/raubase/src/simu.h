@@ -25,9 +25,25 @@
 #define SIMU_H
 
 #include "utime.h"
+#include "uhistory.h"
 
 using namespace std;
 
+/**
+ * One gyro or accelerometer sample (x,y,z) for the history */
+class UImuSample
+{
+public:
+  float v[3] = {0};
+  static UImuSample interpolate(const UImuSample & a, const UImuSample & b, float f)
+  {
+    UImuSample r;
+    for (int i = 0; i < 3; i++)
+      r.v[i] = a.v[i] + f * (b.v[i] - a.v[i]);
+    return r;
+  }
+};
+
 /**
  * Class to receive the raw data from the IMU (MPU9250)
  * */
@@ -58,6 +74,9 @@ public:
   float gyroOffset[3];
   float acc[3];
   bool inCalibration = false;
+  /// gyro and accelerometer history (size from robot.ini)
+  UHistory<UImuSample> gyroHistory;
+  UHistory<UImuSample> accHistory;
 
 private:
   /** save to logfile (and/or console)
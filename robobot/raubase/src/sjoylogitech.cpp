@@ -29,7 +29,9 @@
 #include <string>
 #include <string.h>
 #include <unistd.h>
+#include <sys/epoll.h>
 #include "sjoylogitech.h"
+#include "ureactor.h"
 #include "uservice.h"
 #include "cmixer.h"
 #include "cservo.h"
@@ -146,8 +148,8 @@ void SJoyLogitech::setup()
       fprintf(logfile, "%% 6-%d \tButtons pressed\n", number_of_buttons + 5);
       fprintf(logfile, "%% %d-%d \tAxis value\n", number_of_buttons + 6, number_of_axes + number_of_buttons + 5);
     }
-    // start listen thread
-    th1 = new std::thread(runObj, this);
+    // listen to the gamepad after 3 seconds
+    startTimer = reactor.addTimer(0, "joystick start", [this](){ start(); }, 3.0);
     printf("# UJoyLogitech:: joystick found (%s on %s)\n", deviceName.c_str(), joyDevice.c_str());
   }
 //   else
@@ -156,8 +158,21 @@ void SJoyLogitech::setup()
 
 void SJoyLogitech::terminate()
 {
-  if (th1 != nullptr)
-    th1->join();
+  if (startTimer >= 0)
+    // may be called already (then ignored)
+    reactor.removeTimer(startTimer);
+  if (jDevInReactor)
+  {
+    reactor.removeFd(jDev);
+    jDevInReactor = false;
+  }
+  if (joyRunning)
+  { // close device nicely
+    joyRunning = false;
+    if (jDev >= 0)
+      close(jDev);
+    jDev = -1;
+  }
   if (logfile != nullptr)
   {
     fclose(logfile);
@@ -166,56 +181,63 @@ void SJoyLogitech::terminate()
   }
 }
 
-void SJoyLogitech::run()
+void SJoyLogitech::start()
 {
-  UTime t;
-  t.now();
-  sleep(3);
-  bool automaticMode = true;
-  bool automaticModeOld = false;
-  while (not service.stop and joyRunning)
-  { // handling gamepad events
-    // Device is present
-    bool gotEvent = getNewJsData();
-    if (gotEvent)
-    { //Detect manual override toggling
-      if (joyValues.button[BUTTON_START] == 1)
-        automaticMode = true;
-      if (joyValues.button[BUTTON_BACK] == 1)
-        automaticMode = false;
-      //
-      updTime.now();
-      if (not automaticMode)
-      { // we are in manual mode, so
-        // generate robot control from gamepad
-        joyControl();
-      }
-      //
-      if (t.getTimePassed() > 0.01 or ini["Joy_Logitech"]["log_all"] == "true")
-      { // don't save too fast
-        t.now();
-        toLog();
-      }
+  startTimer = -1;
+  if (not joyRunning or service.stop)
+    return;
+  logTime.now();
+  // all events from now
+  jDevInReactor = reactor.addFd(jDev, EPOLLIN, "joystick",
+                                [this](uint32_t events){ readEvents(events); });
+  // mixer is in automatic mode to start with
+  modeChange();
+}
+
+void SJoyLogitech::readEvents(uint32_t /*events*/)
+{ // handling gamepad events
+  if (service.stop or not joyRunning)
+    return;
+  // closed by getNewJsData() if lost
+  int fd = jDev;
+  // all waiting events
+  while (getNewJsData())
+  { //Detect manual override toggling
+    if (joyValues.button[BUTTON_START] == 1)
+      automaticMode = true;
+    if (joyValues.button[BUTTON_BACK] == 1)
+      automaticMode = false;
+    //
+    updTime.now();
+    if (not automaticMode)
+    { // we are in manual mode, so
+      // generate robot control from gamepad
+      joyControl();
     }
-    else
-      usleep(10000);
-    // state change
-    if (automaticMode != automaticModeOld)
-    { // there is a change
-      automaticModeOld = automaticMode;
-      // Tell mixer about the change
-      mixer.setManualControl(not automaticMode, 0, 0);
-      printf("# SJoyLogitech:: state change (auto=%d)\n", automaticMode);
+    //
+    if (logTime.getTimePassed() > 0.01 or ini["Joy_Logitech"]["log_all"] == "true")
+    { // don't save too fast
+      logTime.now();
+      toLog();
     }
   }
-  if (joyRunning)
-  { // close device nicely
-    joyRunning = false;
-    if (jDev >= 0)
-      close(jDev);
-    jDev = -1;
+  if (not joyRunning and jDevInReactor)
+  { // device is closed (lost)
+    reactor.removeFd(fd);
+    jDevInReactor = false;
+  }
+  modeChange();
+}
+
+void SJoyLogitech::modeChange()
+{ // state change
+  if (automaticMode != automaticModeOld)
+  { // there is a change
+    automaticModeOld = automaticMode;
+    // Tell mixer about the change
+    mixer.setManualControl(not automaticMode, 0, 0);
+    printf("# SJoyLogitech:: state change (auto=%d)\n", automaticMode);
   }
-//   printf("# SJoyLogitech:: device closed\n");
 }
 
 bool SJoyLogitech::initJoy()
@@ -260,8 +282,7 @@ bool SJoyLogitech::getNewJsData()
     switch (errno)
     { // may be an error, or just nothing send (buffer full)
       case EAGAIN:
-        //not all send - just continue
-        usleep(100);
+        // no more events
         break;
       default:
         perror("UJoy::getNewJsData (other error device error): ");
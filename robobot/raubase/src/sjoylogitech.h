@@ -24,7 +24,7 @@
 #ifndef SJOYLOGITECH_H
 #define SJOYLOGITECH_H
 
-#include <thread>
+#include <stdint.h>
 #include "utime.h"
 
 /**
@@ -36,8 +36,11 @@ public:
   /** setup and request data */
   void setup();
   /**
-   * regular update tick */
-  void run();
+   * Start handling gamepad events (reactor timer, 3 seconds after setup) */
+  void start();
+  /**
+   * Handle all waiting gamepad events (called by the reactor) */
+  void readEvents(uint32_t events);
   /**
    * terminate */
   void terminate();
@@ -60,13 +63,16 @@ public:
 
 private:
   /// private stuff
-  static void runObj(SJoyLogitech * obj)
-  { // called, when thread is started
-    // transfer to the class run() function.
-    obj->run();
-  }
   void toLog();
-  std::thread * th1;
+  /**
+   * Tell mixer, if manual mode is changed */
+  void modeChange();
+  bool automaticMode = true;
+  bool automaticModeOld = false;
+  /// last log time
+  UTime logTime;
+  int startTimer = -1;
+  bool jDevInReactor = false;
   bool toConsole = false;
   FILE * logfile = nullptr;
   //
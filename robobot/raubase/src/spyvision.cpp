@@ -25,6 +25,9 @@
 #include <string>
 #include <string.h>
 #include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
 #include "spyvision.h"
 #include "steensy.h"
 #include "uservice.h"
@@ -43,6 +46,13 @@ void SPyVision::setup()
     ini["pyvision"]["print"] = "false";
     ini["pyvision"]["enabled"] = "false";
   }
+  if (not ini["pyvision"].has("results"))
+  { // results as text lines on the socket (tcp) or
+    // as binary records on a Unix datagram socket (unix),
+    // frames are then from camera shared memory (camera shm=true)
+    ini["pyvision"]["results"] = "tcp";
+    ini["pyvision"]["result_socket"] = "/tmp/raubase_vision.sock";
+  }
   if (ini["pyvision"]["enabled"] == "true")
   {
     // connect to python server
@@ -58,6 +68,13 @@ void SPyVision::setup()
     }
     else
       printf("# SpyVision:: service not available\n");
+    if (ini["pyvision"]["results"] == "unix")
+    {
+      if (openResultSocket(ini["pyvision"]["result_socket"]))
+        c += ", results on " + resultPath;
+      else
+        printf("# SpyVision:: failed to open result socket %s\n", ini["pyvision"]["result_socket"].c_str());
+    }
     //
     // create logfile
     toConsole = ini["pyvision"]["print"] == "true";
@@ -94,9 +111,20 @@ void SPyVision::terminate()
     }
     sock->terminate();
   }
+  if (resultFd >= 0)
+  {
+    close(resultFd);
+    unlink(resultPath.c_str());
+    resultFd = -1;
+  }
   // close logfile
   if (logfile != nullptr)
   {
+    if (sock != nullptr)
+      fprintf(logfile, "%% %d replies received, %d dropped (queue full), max %d queued\n",
+              sock->received.load(), sock->dropped.load(), sock->maxDepth.load());
+    if (resultCnt > 0)
+      fprintf(logfile, "%% %d binary results received\n", resultCnt);
     fclose(logfile);
     printf("# SPyVision:: logfile closed\n");
   }
@@ -113,11 +141,21 @@ void SPyVision::run()
   printf("# SPyVision is running\n");
   while (not service.stop)
   { // wait for reply
-    std::string r = sock->waitForReply(40); // ms
-    if (r.length() > 1)
-    { // decode the reply
-      toLogRx(r.c_str());
-      decodeReply(r.c_str());
+    float waitMs = 40;
+    if (resultFd >= 0)
+    { // results are binary, text replies are still possible
+      receiveResults(40);
+      waitMs = 0;
+    }
+    std::string r = sock->waitForReply(waitMs);
+    while (not r.empty())
+    { // decode all queued replies
+      if (r.length() > 1)
+      {
+        toLogRx(r.c_str());
+        decodeReply(r.c_str());
+      }
+      r = sock->waitForReply(0);
     }
   }
   th1 = nullptr;
@@ -133,6 +171,7 @@ void SPyVision::decodeReply(const char* reply)
     aruco_y = strtof(p1, (char**)&p1);
     aruco_h = strtof(p1, (char**)&p1);
     aruco_ID = strtol(p1, (char**)&p1, 10);
+    aruco_updateCnt++;
   }
   else if (strncmp(reply, "golfpos ", 8) == 0)
   {
@@ -140,6 +179,76 @@ void SPyVision::decodeReply(const char* reply)
   }
 }
 
+bool SPyVision::openResultSocket(const std::string & path)
+{
+  resultFd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (resultFd < 0)
+    return false;
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  // may be left from last run
+  unlink(addr.sun_path);
+  if (bind(resultFd, (sockaddr *)&addr, sizeof(addr)) != 0)
+  {
+    close(resultFd);
+    resultFd = -1;
+    return false;
+  }
+  resultPath = addr.sun_path;
+  return true;
+}
+
+void SPyVision::receiveResults(int timeoutMs)
+{
+  pollfd pfd = {resultFd, POLLIN, 0};
+  if (poll(&pfd, 1, timeoutMs) <= 0)
+    return;
+  SPyVisionResult r;
+  // all waiting records, one per datagram
+  while (recv(resultFd, &r, sizeof(r), MSG_DONTWAIT) == sizeof(r))
+  {
+    if (strncmp(r.magic, "RVR1", 4) == 0)
+      decodeResult(r);
+  }
+}
+
+void SPyVision::decodeResult(const SPyVisionResult & r)
+{
+  resultCnt++;
+  resultFrameSeq = r.frameSeq;
+  resultFrameTime.setTime(r.sec, r.usec);
+  if (r.type == 1)
+  {
+    aruco_valid = r.valid;
+    aruco_x = r.x;
+    aruco_y = r.y;
+    aruco_h = r.h;
+    aruco_ID = r.id;
+    aruco_updateCnt++;
+  }
+  else if (r.type == 2)
+  {
+    golf_valid = r.valid > 0;
+    golf_count = r.valid;
+    golf_x = r.x;
+    golf_y = r.y;
+  }
+  if (logfile != nullptr or toConsole)
+  {
+    const int MSL = 200;
+    char s[MSL];
+    snprintf(s, MSL, "result %d frame %lu valid %d id %d %g %g %g", r.type,
+             (unsigned long)r.frameSeq, r.valid, r.id, r.x, r.y, r.h);
+    UTime t("now");
+    if (logfile != nullptr)
+      fprintf(logfile, "%lu.%04lu Rx %d %s\n", t.getSec(), t.getMicrosec()/100, resultCnt, s);
+    if (toConsole)
+      printf("%lu.%04lu Rx %d %s\n", t.getSec(), t.getMicrosec()/100, resultCnt, s);
+  }
+}
+
 bool SPyVision::waitForAruco(float timeoutMs)
 {
   UTime t;
@@ -148,7 +257,8 @@ bool SPyVision::waitForAruco(float timeoutMs)
   while (t.getTimePassed() < timeoutMs/1000.0)
   {
     if (aruco_updateCnt != aruco_updateCntLast)
-    {
+    { // used
+      aruco_updateCntLast = aruco_updateCnt;
       updated = true;
       break;
     }
@@ -25,12 +25,40 @@
 #define SPYVISION_H
 
 #include <unistd.h>
+#include <thread>
+#include <stdint.h>
+#include <string>
 
 #include "utime.h"
 #include "usocket.h"
 
 using namespace std;
 
+/**
+ * Binary result record from the Python vision,
+ * one record per datagram on the result (Unix) socket.
+ * Python: struct.pack('<4sIQqIiifff', b'RVR1', type, frameSeq, sec, usec, valid, id, x, y, h)
+ * */
+struct SPyVisionResult
+{
+  /// "RVR1"
+  char magic[4];
+  /// 1 = aruco, 2 = golf
+  uint32_t type;
+  /// frame sequence number in camera shared memory ring
+  uint64_t frameSeq;
+  /// frame capture time
+  int64_t sec;
+  uint32_t usec;
+  /// aruco: valid, golf: ball count
+  int32_t valid;
+  /// aruco ID
+  int32_t id;
+  /// aruco position and heading, golf: position of first ball
+  float x, y, h;
+};
+static_assert(sizeof(SPyVisionResult) == 48, "SPyVisionResult must match Python record");
+
 /**
  * Class for interface with vision
  * written in Python
@@ -60,6 +88,17 @@ private:
   /**
    * Decode reply from vision */
   void decodeReply(const char * reply);
+  /**
+   * Open Unix datagram socket for binary results
+   * \returns false if not possible */
+  bool openResultSocket(const std::string & path);
+  /**
+   * Receive all waiting binary results
+   * \param timeoutMs is max wait for the first */
+  void receiveResults(int timeoutMs);
+  /**
+   * Use a binary result record */
+  void decodeResult(const SPyVisionResult & r);
 
 public: // data reply
   // aruco
@@ -73,11 +112,20 @@ public: // data reply
   // golf
   bool golf_valid = false;
   int golf_count = 0;
+  float golf_x = 0;
+  float golf_y = 0;
+  /// frame of the newest binary result (frame sequence in camera shared memory)
+  uint64_t resultFrameSeq = 0;
+  UTime resultFrameTime;
   // missing a vector of found ball positions
   // or something similar
 
 private:
   USocket * sock = nullptr;
+  /// Unix datagram socket for binary results (-1 if not used)
+  int resultFd = -1;
+  std::string resultPath;
+  int resultCnt = 0;
   //
   void toLogRx(const char * got);
   void toLogTx(const char * cmd);
@@ -33,8 +33,10 @@
 #include <math.h>
 #include <string.h>
 #include <termios.h>
+#include <sys/epoll.h>
 
 #include "steensy.h"
+#include "ureactor.h"
 #include "uservice.h"
 #include "sstate.h"
 #include "sencoder.h"
@@ -143,8 +145,9 @@ void STeensy::setup()
     // save to Regbot flash
     teensy1.send("eew\n");
   }
-  // start thread and open teensy connection
-  th1 = new std::thread(runObj, this);
+  // open teensy connection and supervise the tx queue (in reactor thread)
+  superviseTime.now();
+  superviseTimer = reactor.addTimer(0.005, "teensy supervise", [this](){ supervise(); }, 0.001);
   // allow thread to open connection
   UTime t("now");
   while (not teensyConnectionOpen and t.getTimePassed() < 10.0)
@@ -165,11 +168,12 @@ void STeensy::terminate()
   while (outQueue.size() > 0 and t.getTimePassed() < 1)
     usleep(1000);
   stopUSB = true;
-  if (th1 != nullptr)
+  if (superviseTimer >= 0)
   {
-    th1->join();
-//     printf("# STeensy:: read thread closed\n");
+    reactor.removeTimer(superviseTimer);
+    superviseTimer = -1;
   }
+  closeUSB();
   // close logfile if open
   if (logfile != nullptr)
   {
@@ -208,6 +212,9 @@ void STeensy::sendToQueue(const char* message)
   toLogQu();
 //   printf("# STeensy::sendToQueue: added '%s' tx-queue, now size %d\n", outQueue.back().msg, (int)outQueue.size());
   dataLock.unlock();
+  // send now, if the queue was empty
+  if (superviseTimer >= 0)
+    reactor.post([this](){ sendQueued(); });
 }
 
 bool STeensy::generateCRC(const char * cmd, char * crc)
@@ -243,6 +250,8 @@ bool STeensy::sendDirect(const char* message)
   int t = 0;
   bool lostConnection = false;
   bool sendOK = false;
+  // the reactor thread must not sleep
+  bool inReactor = reactor.inReactor();
   std::string cmd = message;
   // remove any source information as this is not relevant for the Teensy
   if (teensyConnectionOpen and cmd[0] != '#')
@@ -270,7 +279,11 @@ bool STeensy::sendDirect(const char* message)
     //     fprintf(logfile, "\n");
     // }
     // // ########## END DEBUG ##############
-    if (teensyConnectionOpen)
+    if (teensyConnectionOpen and not sendUnsent())
+    { // the rest of the last line must go first
+      printf("STeensy::sendDirect: port full - dropped %s", cmd.c_str());
+    }
+    else if (teensyConnectionOpen)
     {
       sendCnt++;
       // printf("# STeensy sending directly CRC:'%s', msg:'%s'\n", crc, cmd-c_str());
@@ -285,6 +298,12 @@ bool STeensy::sendDirect(const char* message)
           switch (errno)
           { // may be an error, or just nothing send (buffer full)
             case EAGAIN:
+              if (inReactor)
+              { // must not wait, the rest of a started line is send from supervise()
+                printf("STeensy::sendDirect: port full - %s %d/%d\n", d > 0 ? "rest later" : "dropped", d, n);
+                t = timeoutMs;
+                break;
+              }
               //not all send - just continue
               printf("STeensy::sendDirect: waiting - nothing send %d/%d\n", d, n);
               usleep(1000);
@@ -305,6 +324,9 @@ bool STeensy::sendDirect(const char* message)
           d += m;
       }
       sendOK = d == n;
+      if (d > 0 and d < n and not lostConnection)
+        // finish the line later, else the next line is appended to this part
+        unsent = cmd.substr(d);
       dataLock.lock();
       if (logfile != nullptr)
       {
@@ -316,7 +338,9 @@ bool STeensy::sendDirect(const char* message)
       }
       dataLock.unlock();
       // include a short break to ensure that Teensy do not get overloaded
-      usleep(500);
+      // (the reactor spaces its messages using timers)
+      if (not inReactor)
+        usleep(500);
     }
     if (lostConnection)
     {
@@ -341,6 +365,18 @@ bool STeensy::sendDirect(const char* message)
   return sendOK;
 }
 
+bool STeensy::sendUnsent()
+{ // sendLock is locked
+  while (not unsent.empty())
+  {
+    int m = write(usbport, unsent.c_str(), unsent.size());
+    if (m <= 0)
+      return false;
+    unsent.erase(0, m);
+  }
+  return true;
+}
+
 ////////////////////////////////////////////////////////////////////////
 
 void STeensy::closeUSB()
@@ -352,10 +388,22 @@ void STeensy::closeUSB()
 //     printf("# STeensy::run - no relevant activity, shutting down\n");
 //     printf("# STeensy::run but open=%d, gotAct=%d, lastTime=%f, just=%d, justTime=%g\n",
 //           teensyConnectionOpen, gotActivityRecently, lastRxTime.getTimePassed(), justConnected, justConnectedTime.getTimePassed());
-    // then close the connection (after 100ms)
-    usleep(100000);
-    close(usbport);
+    // no more reading
+    reactor.removeFd(usbport);
+    // then close the connection (after 100ms),
+    // without blocking the reactor thread
+    int fd = usbport;
     usbport = -1;
+    if (reactor.addTimer(0, "teensy close", [fd](){ close(fd); }, 0.1) < 0)
+    { // no reactor
+      usleep(100000);
+      close(fd);
+    }
+    // a partial line is of no use to a new connection
+    unsent.clear();
+    // open again after 300ms (after close)
+    openTryTime.now();
+    connectStep = 0;
     justConnected = false;
     // stop the tx queue and empty any remaining
     confirmSend = false;
@@ -367,220 +415,214 @@ void STeensy::closeUSB()
 
 
 /**
-  * receive thread */
-void STeensy::run()
-{ // read thread for REGBOT messages
-  int n = 0;
-  rxCnt = 0;
-  int readIdleLoops = 0;
-  UTime t, terr;
-  t.now();
-  terr.now();
-  const int MTS = 10;
-  UTime tit[MTS];
-  UTime msgTime;
-  float titsum[MTS] = {0};
-  // get robot name
-  tit[9].now();
-  bool ntpUpdate = false;
-  while (not stopUSB)
-  { // handle Teensy connection
-    if ((not ntpUpdate) and
-        (
-          (teensyConnectionOpen and
-            not gotActivityRecently and
-            lastRxTime.getTimePassed() > 10
-          )
-          or
-          ( justConnected and
-            justConnectedTime.getTimePassed() > 20.0
-          )
-        ))
-    { // connection timeout or failed to get connection name within 10 seconds, probably a wrong device
-      // - shut down connection and try another
-      tit[0].now();
-      // close for now
-      closeUSB();
-      // try another device
-//       usbdeviceNum = (usbdeviceNum + 1) % MAX_USB_DEVS;
-      titsum[0] += tit[0].getTimePassed();
-    }
-    else if (not teensyConnectionOpen)
-    { // wait a second (or 2) then try to open the Teensy device
-      tit[1].now();
-//       sleep(1);
-      // then try to connect
+  * connection supervision and tx queue retry (reactor timer) */
+void STeensy::supervise()
+{
+  if (stopUSB)
+    return;
+  // a long gap between calls is likely a NTP update
+  bool ntpUpdate = superviseTime.getTimePassed() > 2.0;
+  if (ntpUpdate)
+  { // don't close connection based on a NPT update
+    printf("# NTP update? time glitch of %.3f sec\n", superviseTime.getTimePassed());
+
+    pose.resetPose();
+    mixer.setTurnrate(0);
+    mixer.setVelocity(0);
+
+    fflush(nullptr);
+  }
+  superviseTime.now();
+  if ((not ntpUpdate) and
+      (
+        (teensyConnectionOpen and
+          not gotActivityRecently and
+          lastRxTime.getTimePassed() > 10
+        )
+        or
+        ( justConnected and
+          justConnectedTime.getTimePassed() > 20.0
+        )
+      ))
+  { // connection timeout or failed to get connection name within 10 seconds, probably a wrong device
+    // - shut down connection and try another
+    closeUSB();
+  }
+  else if (not teensyConnectionOpen)
+  { // try to open the Teensy device (again)
+    if (openTryTime.getTimePassed() > 0.3)
+    {
+      openTryTime.now();
       openToTeensy();
-      titsum[1] += tit[1].getTimePassed();
     }
-    else
-    { // we are connected
-      //
-      if (justConnected)
+  }
+  else
+  { // we are connected
+    //
+    if (connectStep > 0)
+    { // just connected, send requests a few ms apart (not sleeping)
+      float dt = connectStepTime.getTimePassed();
+      if (connectStep == 1 and dt > 0.005)
+      {
+        send("sub hbt 50\n", true);
+        connectStep = 2;
+        connectStepTime.now();
+      }
+      else if (connectStep == 2 and dt > 0.05)
       { // no name is received yet, so try again
-        tit[2].now();
-        // justconnected flag is cleared when receiving a 'dname' message from Teensy
         send("hbti\n", true); // this may be lost - but no problem
+        connectStep = 3;
+        connectStepTime.now();
+      }
+      else if (connectStep == 3 and dt > 0.001)
+      {
         send("leave\n", true); // stop any old subscriptions
+        // justconnected flag is cleared when receiving a 'dname' message from Teensy
         justConnected = false;
-        t.now();
-        titsum[2] += tit[2].getTimePassed();
-      }
-      if (gotActivityRecently and lastRxTime.getTimePassed() > 2)
-      { // are loosing data - may be just temporarily
-        gotActivityRecently = false;
-      }
-      // read from USB
-      tit[3].now();
-      //
-      n = read(usbport, &rx[rxCnt], 1);
-      if (n < 0 and errno == EAGAIN)
-      { // no data
-        n = 0;
+        connectStep = 0;
       }
-      else if (n < 0)
-      { // other error - close connection
-        perror("Teensy::run port error");
-        usleep(100000);
-        sendLock.lock();
-        // don't close while sending
-        closeUSB();
-        sendLock.unlock();
-      }
-      titsum[3] += tit[3].getTimePassed();
-      //
-      // got a character - assemble to a text line
-      if (n == 1)
-      { // got a new character
-        tit[4].now(); // timing
-        //
-        if (rxCnt > 0)
-        {
-          rxCnt++;
-        }
-        else if (rx[0] == ';')
-        { // first character in a new message
-          msgTime.now();
-          rxCnt = 1;
+      // queued messages are send after this
+      return;
+    }
+    if (gotActivityRecently and lastRxTime.getTimePassed() > 2)
+    { // are loosing data - may be just temporarily
+      gotActivityRecently = false;
+    }
+    // finish a line, that did not fit in the port
+    sendLock.lock();
+    sendUnsent();
+    sendLock.unlock();
+    sendQueued();
+  }
+}
+
+/**
+  * read from Teensy (reactor, when data is available) */
+void STeensy::readPort(uint32_t /*events*/)
+{
+  if (not teensyConnectionOpen)
+    return;
+  // all that is available
+  const int MAX_RD = 512;
+  char rd[MAX_RD];
+  int n = read(usbport, rd, MAX_RD);
+  if (n < 0 and (errno == EAGAIN or errno == EINTR))
+    return;
+  if (n <= 0)
+  { // error (or device removed) - close connection
+    perror("Teensy::readPort port error");
+    sendLock.lock();
+    // don't close while sending
+    closeUSB();
+    sendLock.unlock();
+    return;
+  }
+  for (int i = 0; i < n; i++)
+  { // assemble to text lines
+    rx[rxCnt] = rd[i];
+    if (rxCnt > 0)
+    {
+      rxCnt++;
+    }
+    else if (rx[0] == ';')
+    { // first character in a new message
+      msgTime.now();
+      rxCnt = 1;
+    }
+    else
+      // not a message start
+      continue;
+    if (rxCnt >= MAX_RX_CNT - 1)
+    { // too long, no newline
+      printf("# Teensy message discarded (too long)\n");
+      rxCnt = 0;
+      continue;
+    }
+    // check for end of message, i.e. a new-line
+    if (rx[rxCnt-1] == '\n')
+    { // terminate string - end of new line
+      rx[rxCnt] = '\0';
+      // save to logfile if open
+      dataLock.lock();
+      toLogRx(rx, msgTime);
+      dataLock.unlock();
+      // handle this message line
+      if (crcCheck(rx))
+      { // got (at least) one valid message
+        const char * okMsg = &rx[3];
+        // check if this is a confirm message
+        if (strncmp(okMsg, "confirm", 7) == 0)
+        { // release next message
+          confirmSend = true;
+          messageConfirmed(rx);
         }
-        // check for end of message, i.e. a new-line
-        if (rx[rxCnt-1] == '\n')
-        { // terminate string - end of new line
-          rx[rxCnt] = '\0';
-          // save to logfile if open
-          dataLock.lock();
-          toLogRx(rx, msgTime);
-          dataLock.unlock();
-          // handle this message line
-          if (crcCheck(rx))
-          { // got (at least) one valid message
-            const char * okMsg = &rx[3];
-            // check if this is a confirm message
-            if (strncmp(okMsg, "confirm", 7) == 0)
-            { // release next message
-              confirmSend = true;
-//               printf("# STeensy::run: received a confirm: '%s'\n", rx);
-              messageConfirmed(rx);
-            }
-            else
-            {
-              decode(okMsg, msgTime);
-            }
-          }
-          else
-            printf("# Teenst message discarded (crc-error) %s\n", rx);
-          // set activity timeer
-          gotActivityRecently = true;
-          lastRxTime.now();
-          // reset receive buffer
-          rxCnt = 0;
-          n = 0;
-          gotCnt++;
+        else
+        {
+          decode(okMsg, msgTime);
         }
-        titsum[4] += tit[4].getTimePassed();
-      }
-      else if (n == 0)
-      {  // no data, so wait a bit
-        tit[5].now();
-        //
-        usleep(1000);
-        readIdleLoops++;
-        titsum[5] += tit[5].getTimePassed();
       }
       else
-      { // debug n!= 0 and n!= 1
-        tit[6].now();
-        printf("# Teensy::run: got n=%d chars, when asking for 1!\n", n);
-        fflush(nullptr);
-        titsum[6] += tit[6].getTimePassed();
+        printf("# Teenst message discarded (crc-error) %s\n", rx);
+      // set activity timeer
+      gotActivityRecently = true;
+      lastRxTime.now();
+      // reset receive buffer
+      rxCnt = 0;
+      gotCnt++;
+    }
+  }
+  // next queued message, if the first is confirmed
+  sendQueued();
+}
+
+void STeensy::sendQueued()
+{
+  if (outQueue.empty() or not teensyConnectionOpen or connectStep > 0)
+    return;
+  if (not outQueue.front().isSend)
+  { // new message to send
+    sendLock.lock();
+    if (teensyConnectionOpen)
+    { // send queued message to Teensy
+      if (write(usbport, outQueue.front().msg, outQueue.front().len) != outQueue.front().len)
+        // resend after confirm timeout
+        toLog("# STeensy::sendQueued: write incomplete");
+      outQueue.front().sendAt.now();
+      outQueue.front().isSend = true;
+      outQueue.front().resendCnt++;
+      toLogTx();
+    }
+    sendLock.unlock();
+  }
+  else
+  { // waiting for confirmation - check for too old
+    float dt = outQueue.front().sendAt.getTimePassed();
+    if (dt > confirmTimeout)
+    {
+      // debug
+      const int MSL = 150;
+      char s[MSL];
+      snprintf(s, MSL, "# STeensy::sendQueued: msg retry after %.5f sec (retry=%d, queue=%d):%s",
+              outQueue.front().sendAt.getTimePassed(),
+              outQueue.front().resendCnt,
+              (int)outQueue.size(),
+              outQueue.front().msg);
+      toLog(s);
+      // debug end
+      if (outQueue.front().resendCnt < confirmRetryCntMax)
+      { // just try again (now)
+        outQueue.front().isSend = false;
+        confirmRetryCnt++;
+        sendQueued();
       }
-      if (not outQueue.empty())
-      { // got the first confirm
-//         printf("#STeensy:: que not empty\n");
-        tit[7].now();
-        if (not outQueue.front().isSend)
-        { // new message to send
-          sendLock.lock();
-          if (teensyConnectionOpen)
-          { // send queued message to Teensy
-            write(usbport, outQueue.front().msg, outQueue.front().len);
-            outQueue.front().sendAt.now();
-            outQueue.front().isSend = true;
-            outQueue.front().resendCnt++;
-            toLogTx();
-          }
-          sendLock.unlock();
-        }
-        else
-        { // waiting for confirmation - check for too old
-//           printf("# STeensy:: is send - waiting for confirm\n");
-          float dt = outQueue.front().sendAt.getTimePassed();
-          if (dt > confirmTimeout)
-          {
-            // debug
-            const int MSL = 150;
-            char s[MSL];
-            snprintf(s, MSL, "# STeensy::run: msg retry after %.5f sec (retry=%d, queue=%d):%s",
-                    outQueue.front().sendAt.getTimePassed(),
-                    outQueue.front().resendCnt,
-                    (int)outQueue.size(),
-                    outQueue.front().msg);
-            toLog(s);
-//             printf("%s\n", s);
-            // debug end
-            if (outQueue.front().resendCnt < confirmRetryCntMax)
-            { // just try again
-              outQueue.front().isSend = false;
-              confirmRetryCnt++;
-            }
-            else
-            { // remove from queue
-              outQueue.pop();
-              confirmRetryDump++;
-            }
-          }
-        }
-        titsum[7] += tit[7].getTimePassed();
+      else
+      { // remove from queue
+        outQueue.pop();
+        confirmRetryDump++;
       }
-    } // connected
-    ntpUpdate = false;
-    if (tit[9].getTimePassed() > 2.0)
-    { // likely NTP update received
-      titsum[9]+= tit[9].getTimePassed();
-      // don't close connection based on a NPT update
-      ntpUpdate = true;
-      printf("# NTP update? time glitch of %.3f sec\n", tit[9].getTimePassed());
-      
-      pose.resetPose();
-      mixer.setTurnrate(0);
-      mixer.setVelocity(0);
-
-      fflush(nullptr);
     }
-    tit[9].now();
   }
-  closeUSB();
-}  
+}
 
 bool STeensy::crcCheck(const char* msg)
 { // not really a standard CRC check, just modulus of all visible characters
@@ -662,8 +704,7 @@ bool STeensy::openToTeensy()
         snprintf(s, MSL, "# STeensy::openToTeensy open '%s' failed:",  usbDevName.c_str());
         perror(s);
       }
-      // wait a bit before re-connection
-      usleep(300000);
+      // next try after 300ms (see supervise())
       connectErrCnt++;
     }
     else
@@ -687,15 +728,18 @@ bool STeensy::openToTeensy()
     }
     teensyConnectionOpen = usbport != -1;
     if (teensyConnectionOpen)
-    { // request base data
+    { // read when data is available
+      rxCnt = 0;
+      reactor.addFd(usbport, EPOLLIN, "teensy", [this](uint32_t events){ readPort(events); });
+      // request base data
 //       printf("# STeensy::run - just connected to '%s'\n", usbDevName);
       justConnected = true;
       toLog("Connection to USB open\n");
       justConnectedTime.now();
       teensy1.send("hbti\n", true);
-      usleep(5000);
-      teensy1.send("sub hbt 50\n", true);
-      usleep(50000);
+      // the rest is send by supervise()
+      connectStep = 1;
+      connectStepTime.now();
       //         initMessageTypes();
       // assume there is activity - in order not to
       // get an error right away
@@ -27,7 +27,7 @@
 
 #include <mutex>
 #include <queue>
-#include <thread>
+#include <stdint.h>
 #include <string.h>
 #include <string>
 
@@ -111,7 +111,7 @@ private:
   static const int MAX_RX_CNT = 1000;
   char rx[MAX_RX_CNT];
   // number of characters in rx buffer
-  int rxCnt;
+  int rxCnt = 0;
   //
   UTime lastTxTime;
   // socket to simulator
@@ -124,8 +124,15 @@ private:
   bool justConnected = false;
   bool confirmSend = false;
 //   bool sendDirectFromNowOn = false;
-
-  std::thread * th1;
+  /// start of message being received
+  UTime msgTime;
+  /// last supervise() call (to detect time jumps)
+  UTime superviseTime;
+  UTime openTryTime;
+  int superviseTimer = -1;
+  /// messages after connect: 1 = send 'sub hbt', 2 = 'hbti', 3 = 'leave', 0 = done
+  int connectStep = 0;
+  UTime connectStepTime;
 
   
 public:
@@ -145,10 +152,13 @@ public:
    * \returns true if send direct and delivered OK */
   bool send(const char * message, bool direct = false);
   /**
-   * runs the receive thread 
-   * This run() function is called in a thread after a start() call.
-   * This function will not return until the thread is stopped. */
-  void run();
+   * Open connection (again) when needed, resend unconfirmed messages.
+   * Called periodically by the reactor. */
+  void supervise();
+  /**
+   * Read from the Teensy (called by the reactor, when data is available),
+   * and decode complete messages */
+  void readPort(uint32_t events);
   /**
   * decode commands potentially for this device */
   bool decode(const char* msg, UTime & msgTime);
@@ -174,6 +184,12 @@ private:
   /**
    * send this message directly to the Teensy port */
   bool sendDirect(const char* message);
+  /**
+   * Send the rest of a line that did not fit in the port (sendLock must be locked)
+   * \returns true if nothing is left */
+  bool sendUnsent();
+  /// rest of last line, when the port was full (reactor thread does not wait)
+  std::string unsent;
   /**
    * Check for crc error
    * \param rawMsg is the message preceded by crc
@@ -186,11 +202,10 @@ private:
     return (usbport >= 0) and gotActivityRecently and not justConnected;
   }
 
-  static void runObj(STeensy * obj)
-  { // called, when thread is started
-    // transfer to the class run() function.
-    obj->run();
-  }
+  /**
+   * Send first message in queue, if not send already,
+   * or resend if not confirmed (reactor thread only) */
+  void sendQueued();
 
 private:
   /**
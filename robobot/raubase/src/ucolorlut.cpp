@@ -0,0 +1,125 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#include <math.h>
+#include <opencv2/imgproc.hpp>
+#include "ucolorlut.h"
+#include "utime.h"
+
+
+void UColorLut::setBits(int newBits)
+{
+  if (newBits < 1)
+    newBits = 1;
+  else if (newBits > 8)
+    newBits = 8;
+  if (newBits != bits)
+  {
+    bits = newBits;
+    valid = false;
+  }
+}
+
+void UColorLut::setBounds(cv::Scalar lowHsv, cv::Scalar highHsv)
+{
+  if (lowHsv != lb or highHsv != ub)
+  {
+    lb = lowHsv;
+    ub = highHsv;
+    valid = false;
+  }
+  if (not valid)
+    build();
+}
+
+void UColorLut::build()
+{ // one BGR pixel for the centre of each table cell,
+  // index is (b << 2*bits) | (g << bits) | r
+  int n = 1 << bits;
+  int shift = 8 - bits;
+  int half = (1 << shift) / 2;
+  cv::Mat centers(n * n, n, CV_8UC3);
+  for (int b = 0; b < n; b++)
+    for (int g = 0; g < n; g++)
+    {
+      cv::Vec3b * row = centers.ptr<cv::Vec3b>(b * n + g);
+      for (int r = 0; r < n; r++)
+        row[r] = cv::Vec3b((b << shift) + half, (g << shift) + half, (r << shift) + half);
+    }
+  // classify using the same conversion as the OpenCV path
+  cv::Mat hsv, in;
+  cv::cvtColor(centers, hsv, cv::COLOR_BGR2HSV);
+  cv::inRange(hsv, lb, ub, in);
+  lut.assign(in.datastart, in.dataend);
+  valid = true;
+}
+
+void UColorLut::classify(const cv::Mat & bgr, cv::Mat & mask)
+{
+  CV_Assert(bgr.type() == CV_8UC3);
+  if (not valid)
+    build();
+  mask.create(bgr.size(), CV_8UC1);
+  const int shift = 8 - bits;
+  const int b1 = bits;
+  const int b2 = 2 * bits;
+  const uchar * table = lut.data();
+  cv::parallel_for_(cv::Range(0, bgr.rows), [&](const cv::Range & range)
+  {
+    for (int y = range.start; y < range.end; y++)
+    {
+      const uchar * p = bgr.ptr<uchar>(y);
+      uchar * m = mask.ptr<uchar>(y);
+      for (int x = 0; x < bgr.cols; x++, p += 3)
+        m[x] = table[((p[0] >> shift) << b2) | ((p[1] >> shift) << b1) | (p[2] >> shift)];
+    }
+  });
+}
+
+float UColorLut::benchmark(const cv::Mat & bgr, int loops)
+{
+  if (bgr.empty() or loops < 1)
+    return 0;
+  cv::Mat hsv, maskCv, maskLut;
+  UTime t;
+  t.now();
+  for (int i = 0; i < loops; i++)
+  {
+    cv::cvtColor(bgr, hsv, cv::COLOR_BGR2HSV);
+    cv::inRange(hsv, lb, ub, maskCv);
+  }
+  float cvMs = t.getTimePassed() * 1000 / loops;
+  t.now();
+  for (int i = 0; i < loops; i++)
+    classify(bgr, maskLut);
+  float lutMs = t.getTimePassed() * 1000 / loops;
+  // equivalence
+  cv::Mat diff;
+  cv::compare(maskCv, maskLut, diff, cv::CMP_NE);
+  int differ = cv::countNonZero(diff);
+  float fraction = float(differ) / float(bgr.total());
+  printf("# UColorLut:: %dx%d image, %d bits: HSV+inRange %.2f ms, lookup table %.2f ms (%.1fx)\n",
+         bgr.cols, bgr.rows, bits, cvMs, lutMs, cvMs / fmaxf(lutMs, 1e-3));
+  printf("# UColorLut:: in range: OpenCV %d, table %d pixels, differ %d pixels (%.3f%%)\n",
+         cv::countNonZero(maskCv), cv::countNonZero(maskLut), differ, fraction * 100);
+  return fraction;
+}
@@ -0,0 +1,70 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#pragma once
+
+#include <vector>
+#include <opencv2/core.hpp>
+
+/**
+ * Colour classifier using a lookup table from (quantized) BGR to in/out,
+ * made from HSV bounds as used by cv::inRange on a HSV image.
+ * Makes the binary mask in one pass directly from the BGR image,
+ * with no HSV conversion and no intermediate image.
+ *
+ * With 8 bits per channel the table is exact (16MB), with fewer bits
+ * each table cell is classified by the colour at the cell centre.
+ * */
+class UColorLut
+{
+public:
+  /**
+   * Set number of bits used per colour channel [1..8]
+   * The table has 2^(3*bits) entries (5 bits gives 32kB). */
+  void setBits(int bits);
+  /**
+   * Set HSV bounds (as for cv::inRange after cv::COLOR_BGR2HSV).
+   * The table is rebuilt only if bounds (or bits) changed. */
+  void setBounds(cv::Scalar lowHsv, cv::Scalar highHsv);
+  /**
+   * Make mask from BGR image
+   * \param bgr is a CV_8UC3 image
+   * \param mask is set to a CV_8UC1 image with 255 for pixels in range, else 0. */
+  void classify(const cv::Mat & bgr, cv::Mat & mask);
+  /**
+   * Compare time and result with the OpenCV HSV and inRange path
+   * on this image, and print the result to the console.
+   * \param loops is number of repeats for the timing.
+   * \returns the fraction of pixels, where the masks differ. */
+  float benchmark(const cv::Mat & bgr, int loops = 20);
+
+private:
+  /// rebuild the table from bounds
+  void build();
+  std::vector<uchar> lut;
+  int bits = 5;
+  cv::Scalar lb = cv::Scalar(-1, -1, -1);
+  cv::Scalar ub = cv::Scalar(-1, -1, -1);
+  /// table valid for these bits and bounds
+  bool valid = false;
+};
+
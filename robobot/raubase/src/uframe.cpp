@@ -0,0 +1,107 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#include <chrono>
+#include "uframe.h"
+
+
+cv::Mat & UFrameStore::writeBuffer()
+{
+  std::lock_guard<std::mutex> guard(lock);
+  // use a slot that is not the newest frame
+  if (writing == newest)
+    writing = (writing + 1) % SLOTS;
+  cv::Mat & img = slot[writing].img;
+  if (img.u != nullptr and img.u->refcount > 1)
+    // a reader still use this image,
+    // release, so that a new buffer is allocated
+    img.release();
+  return img;
+}
+
+std::vector<uchar> & UFrameStore::writeJpeg()
+{
+  std::lock_guard<std::mutex> guard(lock);
+  if (writing == newest)
+    writing = (writing + 1) % SLOTS;
+  std::shared_ptr<std::vector<uchar>> & jpeg = slot[writing].jpeg;
+  if (not jpeg or jpeg.use_count() > 1)
+    // a reader may still use the data
+    jpeg = std::make_shared<std::vector<uchar>>();
+  return *jpeg;
+}
+
+void UFrameStore::publish(UTime & captureTime, cv::Size size)
+{
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    seq++;
+    if (size.empty())
+      size = slot[writing].img.size();
+    slot[writing].size = size;
+    slot[writing].seq = seq;
+    slot[writing].t = captureTime;
+    newest = writing;
+    writing = (writing + 1) % SLOTS;
+  }
+  newFrame.notify_all();
+}
+
+bool UFrameStore::getNewest(UFrame & frame)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  if (newest < 0)
+    return false;
+  frame = slot[newest];
+  return true;
+}
+
+bool UFrameStore::waitNext(UFrame & frame, float timeoutSec)
+{
+  int s;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    s = seq;
+  }
+  return waitNewer(s, frame, timeoutSec);
+}
+
+bool UFrameStore::waitNewer(int lastSeq, UFrame & frame, float timeoutSec)
+{
+  std::unique_lock<std::mutex> guard(lock);
+  auto timeout = std::chrono::microseconds(int64_t(timeoutSec * 1e6));
+  bool got = newFrame.wait_for(guard, timeout, [&]{ return newest >= 0 and seq > lastSeq; });
+  if (got)
+    frame = slot[newest];
+  return got;
+}
+
+void UFrameStore::clear()
+{
+  std::lock_guard<std::mutex> guard(lock);
+  for (int i = 0; i < SLOTS; i++)
+  {
+    slot[i].img.release();
+    slot[i].jpeg.reset();
+  }
+  newest = -1;
+}
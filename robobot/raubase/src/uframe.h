@@ -0,0 +1,118 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+
+
+#pragma once
+
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <condition_variable>
+#include <opencv2/core.hpp>
+
+#include "utime.h"
+
+/**
+ * One camera frame with sequence number and capture time.
+ * The image is a cv::Mat header, so copying a frame
+ * does not copy the pixel data.
+ * The image may be empty, if the frame is not decoded by the camera thread,
+ * then the compressed (JPEG) data is available instead. */
+class UFrame
+{
+public:
+  cv::Mat img;
+  /// compressed frame from camera (MJPEG), empty if not available
+  std::shared_ptr<std::vector<uchar>> jpeg;
+  /// full image size (also when not decoded)
+  cv::Size size;
+  /// frame sequence number (first frame is 1)
+  int seq = 0;
+  /// capture time
+  UTime t;
+};
+
+/**
+ * Triple buffered store for the newest camera frame.
+ * One writer (the camera thread) fills a buffer and publishes it,
+ * any number of readers can get the newest frame without copying.
+ * A buffer still in use by a reader is not overwritten, the writer
+ * gets a fresh buffer instead.
+ * */
+class UFrameStore
+{
+public:
+  /**
+   * Get the buffer to fill with the next frame.
+   * The buffer belongs to the writer until publish(). */
+  cv::Mat & writeBuffer();
+  /**
+   * Get the buffer for the compressed frame (in the same slot as writeBuffer()).
+   * The buffer belongs to the writer until publish(). */
+  std::vector<uchar> & writeJpeg();
+  /**
+   * The write buffer is filled, make it the newest frame.
+   * \param captureTime is the time the frame was captured.
+   * \param size is the full image size, if not set, then the size of the image */
+  void publish(UTime & captureTime, cv::Size size = cv::Size());
+  /**
+   * Get the newest frame without waiting
+   * \returns false if there is no frame yet */
+  bool getNewest(UFrame & frame);
+  /**
+   * Wait for the next frame, i.e. a frame published after this call
+   * \param timeoutSec is max wait time in seconds
+   * \returns false on timeout */
+  bool waitNext(UFrame & frame, float timeoutSec);
+  /**
+   * Wait for a frame newer than this sequence number.
+   * Returns at once, if the newest frame is newer already.
+   * \param seq is the sequence number of a frame already used
+   * \param timeoutSec is max wait time in seconds
+   * \returns false on timeout */
+  bool waitNewer(int seq, UFrame & frame, float timeoutSec);
+  /**
+   * Sequence number of newest frame (0 if none) */
+  int getSeq()
+  { // published by the camera thread
+    std::lock_guard<std::mutex> guard(lock);
+    return seq;
+  }
+  /**
+   * Remove all frames (e.g. when camera is closed),
+   * sequence numbers continue to increase. */
+  void clear();
+
+private:
+  static const int SLOTS = 3;
+  UFrame slot[SLOTS];
+  /// slot with newest frame (-1 if none)
+  int newest = -1;
+  /// slot used by the writer
+  int writing = 0;
+  /// sequence number of newest frame
+  int seq = 0;
+  std::mutex lock;
+  std::condition_variable newFrame;
+};
+
@@ -0,0 +1,166 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include "uframecache.h"
+
+
+cv::Mat & UFrameImages::decodeLocked(int si, bool gray)
+{
+  cv::Mat & img = (si == 0 and not gray) ? frame.img : scaled[si][gray];
+  if (not img.empty())
+    return img;
+  if (not frame.img.empty())
+  { // full image is decoded already, reduce this
+    if (gray)
+    {
+      if (si == 0)
+        cv::cvtColor(frame.img, img, cv::COLOR_BGR2GRAY);
+      else
+        cv::cvtColor(decodeLocked(si, false), img, cv::COLOR_BGR2GRAY);
+    }
+    else
+      cv::resize(frame.img, img, cv::Size(), 1.0 / (1 << si), 1.0 / (1 << si), cv::INTER_AREA);
+    made++;
+  }
+  else if (frame.jpeg and not frame.jpeg->empty())
+  { // decoder can scale the DCT blocks and skip colour conversion
+    const int colorFlags[4] = {cv::IMREAD_COLOR, cv::IMREAD_REDUCED_COLOR_2,
+                               cv::IMREAD_REDUCED_COLOR_4, cv::IMREAD_REDUCED_COLOR_8};
+    const int grayFlags[4] = {cv::IMREAD_GRAYSCALE, cv::IMREAD_REDUCED_GRAYSCALE_2,
+                              cv::IMREAD_REDUCED_GRAYSCALE_4, cv::IMREAD_REDUCED_GRAYSCALE_8};
+    cv::imdecode(*frame.jpeg, gray ? grayFlags[si] : colorFlags[si], &img);
+    made++;
+    decodes++;
+  }
+  return img;
+}
+
+cv::Mat UFrameImages::decoded(int scale, bool gray)
+{
+  int si = 0;
+  while (si < 3 and (1 << si) < scale)
+    si++;
+  std::lock_guard<std::mutex> guard(lock);
+  return decodeLocked(si, gray);
+}
+
+cv::Mat UFrameImages::rectified()
+{
+  std::lock_guard<std::mutex> guard(lock);
+  if (rectifiedImg.empty() and rectify)
+  {
+    cv::Mat raw = decodeLocked(0, false);
+    if (not raw.empty())
+    {
+      rectify(raw, rectifiedImg);
+      made++;
+    }
+  }
+  return rectifiedImg;
+}
+
+cv::Mat UFrameImages::gray(bool ofRectified)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  if (not ofRectified)
+    return decodeLocked(0, true);
+  if (grayRectifiedImg.empty())
+  {
+    if (not rectifiedImg.empty())
+      cv::cvtColor(rectifiedImg, grayRectifiedImg, cv::COLOR_BGR2GRAY);
+    else if (rectify)
+    { // rectify the luma only, the colour image is not needed
+      cv::Mat raw = decodeLocked(0, true);
+      if (not raw.empty())
+        rectify(raw, grayRectifiedImg);
+    }
+    if (not grayRectifiedImg.empty())
+      made++;
+  }
+  return grayRectifiedImg;
+}
+
+cv::Mat UFrameImages::blurred()
+{
+  std::lock_guard<std::mutex> guard(lock);
+  if (blurredImg.empty())
+  {
+    cv::Mat raw = decodeLocked(0, false);
+    if (not raw.empty())
+    {
+      cv::GaussianBlur(raw, blurredImg, cv::Size(11, 11), 0);
+      made++;
+    }
+  }
+  return blurredImg;
+}
+
+cv::Mat UFrameImages::hsv()
+{
+  cv::Mat blur = blurred();
+  std::lock_guard<std::mutex> guard(lock);
+  if (hsvImg.empty() and not blur.empty())
+  {
+    cv::cvtColor(blur, hsvImg, cv::COLOR_BGR2HSV);
+    made++;
+  }
+  return hsvImg;
+}
+
+cv::Mat UFrameImages::level(int n)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  cv::Mat raw = decodeLocked(0, false);
+  if (n <= 0 or raw.empty())
+    return raw;
+  if (levels.empty())
+    levels.push_back(raw);
+  while ((int)levels.size() <= n)
+  { // make the missing levels from the largest made so far
+    cv::Mat down;
+    cv::pyrDown(levels.back(), down);
+    levels.push_back(down);
+    made++;
+  }
+  return levels[n];
+}
+
+std::shared_ptr<UFrameImages> UFrameCache::get(const UFrame & frame)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  for (int i = 0; i < SLOTS; i++)
+  {
+    if (slot[i] and slot[i]->frame.seq == frame.seq and slot[i]->frame.t == frame.t)
+    {
+      hits++;
+      return slot[i];
+    }
+  }
+  // not cached, replace the oldest
+  std::shared_ptr<UFrameImages> fi = std::make_shared<UFrameImages>(frame, rectify);
+  slot[next] = fi;
+  next = (next + 1) % SLOTS;
+  frames++;
+  return fi;
+}
@@ -0,0 +1,136 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#pragma once
+
+#include <mutex>
+#include <memory>
+#include <functional>
+#include <opencv2/core.hpp>
+
+#include "uframe.h"
+
+/**
+ * Images derived from one camera frame.
+ * Each image is made on first request only, and then
+ * shared by all detectors working on the same frame.
+ * The returned images are shared, do not modify them.
+ * If the camera thread did not decode the frame, then images are
+ * decoded from the JPEG data at the size (and colour) requested.
+ * */
+class UFrameImages
+{
+public:
+  UFrameImages(const UFrame & source,
+               std::function<void(const cv::Mat &, cv::Mat &)> rectifier)
+    : frame(source), rectify(rectifier)
+  {}
+  /// the raw frame
+  UFrame frame;
+  /**
+   * Full size raw image (decoded if needed) */
+  cv::Mat full()
+  {
+    return decoded(1, false);
+  }
+  /**
+   * Raw image at reduced size.
+   * Decoded from JPEG using the decoder DCT scaling, this is much faster than
+   * a full decode, or reduced from the full image, if it is decoded already.
+   * \param scale is reduction factor 1, 2, 4 or 8
+   * \param gray if true, then luma only (CV_8UC1), else BGR
+   * \returns empty image if no data */
+  cv::Mat decoded(int scale, bool gray = false);
+  /**
+   * Full image size (without decoding) */
+  cv::Size size()
+  {
+    return frame.size.empty() ? frame.img.size() : frame.size;
+  }
+  /**
+   * Undistorted (rectified) image */
+  cv::Mat rectified();
+  /**
+   * Grayscale image, from a luma only decode, if the colour image is not decoded already
+   * \param ofRectified if true, then of rectified image, else of raw image */
+  cv::Mat gray(bool ofRectified = false);
+  /**
+   * Raw image blurred with the 11x11 Gaussian used by the golfball detector */
+  cv::Mat blurred();
+  /**
+   * HSV of the blurred image */
+  cv::Mat hsv();
+  /**
+   * Raw image reduced n times by cv::pyrDown
+   * \param n is level, 0 is the raw image, 1 is half size etc. */
+  cv::Mat level(int n);
+  /// number of derived images made (for statistics)
+  int made = 0;
+  /// number of (full or reduced) decodes from JPEG
+  int decodes = 0;
+
+private:
+  /**
+   * Get reduced image, lock must be locked
+   * \param si is scale index 0..3 for scale 1, 2, 4 and 8 */
+  cv::Mat & decodeLocked(int si, bool gray);
+  std::mutex lock;
+  /// reduced images [scale index][gray], full colour is frame.img
+  cv::Mat scaled[4][2];
+  std::function<void(const cv::Mat &, cv::Mat &)> rectify;
+  cv::Mat rectifiedImg;
+  cv::Mat grayImg, grayRectifiedImg;
+  cv::Mat blurredImg, hsvImg;
+  std::vector<cv::Mat> levels;
+};
+
+/**
+ * Cache of derived images for the newest frames (by sequence number).
+ * Two frames are kept, so a detector still working on the previous
+ * frame does not remove the derived images for the newest frame.
+ * */
+class UFrameCache
+{
+public:
+  /**
+   * Set function used to rectify a raw image */
+  void setRectifier(std::function<void(const cv::Mat &, cv::Mat &)> rectifier)
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    rectify = rectifier;
+  }
+  /**
+   * Get the derived images for this frame
+   * (a new (empty) set, if the frame is not in the cache already) */
+  std::shared_ptr<UFrameImages> get(const UFrame & frame);
+  /// statistics: frames added and number of requests for a cached frame
+  int frames = 0;
+  int hits = 0;
+
+private:
+  static const int SLOTS = 2;
+  std::shared_ptr<UFrameImages> slot[SLOTS];
+  int next = 0;
+  std::function<void(const cv::Mat &, cv::Mat &)> rectify;
+  std::mutex lock;
+};
+
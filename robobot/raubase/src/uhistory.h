@@ -0,0 +1,166 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+
+#ifndef UHISTORY_H
+#define UHISTORY_H
+
+#include <mutex>
+#include <vector>
+
+#include "utime.h"
+
+/**
+ * Fixed capacity ring buffer of timestamped samples.
+ * Samples are added in time order (as they arrive from the Teensy),
+ * so the value at any time inside the buffered period can be found
+ * by a binary search, and interpolated between the two neighbour samples.
+ *
+ * The sample class T must provide
+ *   static T interpolate(const T & a, const T & b, float f);
+ * returning the value a fraction f [0..1] of the way from a to b.
+ * */
+template <class T>
+class UHistory
+{
+public:
+  /**
+   * Set capacity (number of samples) and clear the buffer.
+   * Memory is allocated here only, not when adding samples. */
+  void setup(int capacity)
+  {
+    std::lock_guard<std::mutex> lock(dataLock);
+    if (capacity < 2)
+      capacity = 2;
+    times.resize(capacity);
+    samples.resize(capacity);
+    cap = capacity;
+    head = 0;
+    count = 0;
+  }
+  /**
+   * Add a new sample.
+   * \param t is the sample time, must not be older than the newest sample.
+   * \param value is the sample value */
+  void add(UTime & t, const T & value)
+  {
+    std::lock_guard<std::mutex> lock(dataLock);
+    if (cap == 0)
+      return;
+    times[head] = t;
+    samples[head] = value;
+    head = (head + 1) % cap;
+    if (count < cap)
+      count++;
+  }
+  /**
+   * Get the value at this time, interpolated between
+   * the nearest samples before and after.
+   * \param t is the time of interest.
+   * \param value is set to the (interpolated) value, or
+   *        to the oldest or newest sample, if t is outside the buffered period.
+   * \returns false if t is outside the buffered period or the buffer is empty. */
+  bool at(UTime t, T & value)
+  {
+    std::lock_guard<std::mutex> lock(dataLock);
+    if (count == 0)
+      return false;
+    if (t <= times[idx(0)])
+    { // older than all we have
+      value = samples[idx(0)];
+      return t == times[idx(0)];
+    }
+    if (t >= times[idx(count - 1)])
+    { // newer than all we have
+      value = samples[idx(count - 1)];
+      return t == times[idx(count - 1)];
+    }
+    // binary search for the last sample not after t
+    int lo = 0;
+    int hi = count - 1;
+    while (hi - lo > 1)
+    {
+      int mid = (lo + hi) / 2;
+      if (times[idx(mid)] <= t)
+        lo = mid;
+      else
+        hi = mid;
+    }
+    int a = idx(lo);
+    int b = idx(hi);
+    float dt = times[b] - times[a];
+    float f = 0;
+    if (dt > 0)
+      f = (t - times[a]) / dt;
+    value = T::interpolate(samples[a], samples[b], f);
+    return true;
+  }
+  /**
+   * Get the newest sample
+   * \param value is set to the newest sample (if any)
+   * \param t if not nullptr, then set to the time of the newest sample
+   * \returns false if the buffer is empty */
+  bool newest(T & value, UTime * t = nullptr)
+  {
+    std::lock_guard<std::mutex> lock(dataLock);
+    if (count == 0)
+      return false;
+    value = samples[idx(count - 1)];
+    if (t != nullptr)
+      *t = times[idx(count - 1)];
+    return true;
+  }
+  /**
+   * Number of samples in buffer */
+  int size()
+  {
+    return count;
+  }
+  /**
+   * Time of the oldest sample (zero if empty) */
+  UTime oldestTime()
+  {
+    std::lock_guard<std::mutex> lock(dataLock);
+    UTime t;
+    if (count > 0)
+      t = times[idx(0)];
+    return t;
+  }
+
+private:
+  /**
+   * buffer index of the i'th oldest sample */
+  inline int idx(int i)
+  {
+    return (head - count + i + cap) % cap;
+  }
+  std::mutex dataLock;
+  std::vector<UTime> times;
+  std::vector<T> samples;
+  int cap = 0;
+  /// index for the next sample
+  int head = 0;
+  /// number of valid samples
+  int count = 0;
+};
+
+#endif
@@ -0,0 +1,205 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <opencv2/imgcodecs.hpp>
+
+#include "uimagewriter.h"
+#include "uservice.h"
+
+// create value
+UImageWriter imageWriter;
+
+
+void UImageWriter::setup()
+{ // ensure there is default values in ini-file
+  if (not ini.has("imagewriter"))
+  { // no data yet, so generate some default values
+    ini["imagewriter"]["log"] = "true";
+    ini["imagewriter"]["print"] = "false";
+    ini["imagewriter"]["; max images waiting to be written"] = "";
+    ini["imagewriter"]["queue"] = "8";
+    ini["imagewriter"]["; when queue is full: drop_oldest, drop_newest or wait"] = "";
+    ini["imagewriter"]["policy"] = "drop_oldest";
+    ini["imagewriter"]["jpeg_quality"] = "90";
+    ini["imagewriter"]["; writer thread nice value (0..19, 19 is lowest priority)"] = "";
+    ini["imagewriter"]["nice"] = "10";
+  }
+  toConsole = ini["imagewriter"]["print"] == "true";
+  maxQueue = strtol(ini["imagewriter"]["queue"].c_str(), nullptr, 10);
+  if (maxQueue < 1)
+    maxQueue = 1;
+  const std::string & p = ini["imagewriter"]["policy"];
+  if (p == "drop_newest")
+    policy = 1;
+  else if (p == "wait")
+    policy = 2;
+  else
+    policy = 0;
+  jpegQuality = strtol(ini["imagewriter"]["jpeg_quality"].c_str(), nullptr, 10);
+  niceLevel = strtol(ini["imagewriter"]["nice"].c_str(), nullptr, 10);
+  //
+  if (ini["imagewriter"]["log"] == "true")
+  { // open logfile
+    std::string fn = service.logPath + "log_imagewriter.txt";
+    logfile = fopen(fn.c_str(), "w");
+    fprintf(logfile, "%% Background image writer (%s)\n", fn.c_str());
+    fprintf(logfile, "%% queue %d images, policy %s, nice %d\n", maxQueue, p.c_str(), niceLevel);
+    fprintf(logfile, "%% 1 \tTime (sec)\n");
+    fprintf(logfile, "%% 2 \tMessage, e.g. 'written' filename, encode+write time (ms),\n");
+    fprintf(logfile, "%% \ttime in queue (ms), and images still waiting (backlog)\n");
+  }
+  th1 = new std::thread(runObj, this);
+}
+
+void UImageWriter::terminate()
+{ // write remaining images
+  if (th1 != nullptr)
+  {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      stopWriter = true;
+    }
+    changed.notify_all();
+    th1->join();
+    th1 = nullptr;
+  }
+  if (logfile != nullptr)
+  {
+    fprintf(logfile, "%% images queued %d, written %d, dropped %d, max backlog %d\n",
+            queued, written, dropped, maxBacklog);
+    fclose(logfile);
+    logfile = nullptr;
+  }
+}
+
+bool UImageWriter::save(const cv::Mat & img, const std::string & filename)
+{
+  if (th1 == nullptr)
+  { // no writer thread, so write now
+    cv::imwrite(filename, img);
+    return true;
+  }
+  bool ok = true;
+  int n;
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    if ((int)jobs.size() >= maxQueue)
+    {
+      if (policy == 2)
+        // wait for space in queue
+        changed.wait(guard, [this]{ return stopWriter or (int)jobs.size() < maxQueue; });
+      else
+      {
+        ok = false;
+        dropped++;
+        if (policy == 0)
+          jobs.pop_front();
+      }
+    }
+    if (ok or policy == 0)
+    {
+      UImageJob job;
+      job.img = img;
+      job.filename = filename;
+      job.t.now();
+      jobs.push_back(std::move(job));
+      queued++;
+    }
+    n = jobs.size();
+    if (n > maxBacklog)
+      maxBacklog = n;
+  }
+  changed.notify_all();
+  if (not ok)
+  {
+    const int MSL = 200;
+    char s[MSL];
+    snprintf(s, MSL, "dropped %s image (%d dropped), backlog %d",
+             policy == 0 ? "oldest" : "newest", dropped, n);
+    toLog(s);
+  }
+  return ok;
+}
+
+int UImageWriter::backlog()
+{
+  std::lock_guard<std::mutex> guard(lock);
+  return jobs.size();
+}
+
+void UImageWriter::run()
+{ // lower priority than mission and vision threads (for this thread only)
+  setpriority(PRIO_PROCESS, syscall(SYS_gettid), niceLevel);
+  const std::vector<int> params = {cv::IMWRITE_JPEG_QUALITY, jpegQuality};
+  while (true)
+  {
+    UImageJob job;
+    int n;
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      changed.wait(guard, [this]{ return stopWriter or not jobs.empty(); });
+      if (jobs.empty())
+        // stopped, and all is written
+        break;
+      job = std::move(jobs.front());
+      jobs.pop_front();
+      n = jobs.size();
+    }
+    // there is space in the queue now
+    changed.notify_all();
+    UTime t;
+    t.now();
+    bool ok;
+    try
+    {
+      ok = cv::imwrite(job.filename, job.img, params);
+    }
+    catch (const cv::Exception &)
+    {
+      ok = false;
+    }
+    const int MSL = 400;
+    char s[MSL];
+    if (ok)
+    {
+      written++;
+      snprintf(s, MSL, "written %s %.1f %.1f %d", job.filename.c_str(),
+               t.getTimePassed() * 1000, (t - job.t) * 1000, n);
+    }
+    else
+      snprintf(s, MSL, "failed to write %s", job.filename.c_str());
+    toLog(s);
+  }
+}
+
+void UImageWriter::toLog(const char * message)
+{
+  UTime t("now");
+  std::lock_guard<std::mutex> guard(logLock);
+  if (logfile != nullptr)
+    fprintf(logfile, "%lu.%04ld %s\n", t.getSec(), t.getMicrosec()/100, message);
+  if (toConsole)
+    printf("%lu.%04ld %s\n", t.getSec(), t.getMicrosec()/100, message);
+}
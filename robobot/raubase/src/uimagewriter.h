@@ -0,0 +1,102 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <string>
+#include <condition_variable>
+#include <opencv2/core.hpp>
+
+#include "utime.h"
+
+/**
+ * Background writer for (debug) images.
+ * Images are handed over by reference (no copy), and encoded and
+ * written to file by a low priority thread, so that saving debug images
+ * does not change the timing of the mission or vision threads.
+ * The queue is bounded; when full, an image is dropped, either the oldest
+ * queued or the new one (policy in robot.ini), or the caller waits.
+ * */
+class UImageWriter
+{
+public:
+  /** setup from robot.ini and start writer thread */
+  void setup();
+  /**
+   * Write remaining images and stop writer thread */
+  void terminate();
+  /**
+   * Queue image for writing.
+   * The image data is not copied, so the image must not be modified
+   * after this call (a cv::Mat from an UMatPool is fine, the pool
+   * allocates a new buffer, when this one is still in use).
+   * \param img is the image to save.
+   * \param filename is the full filename, the type must be in the filename (e.g. .jpg)
+   * \returns false if the image (or an older image) is dropped */
+  bool save(const cv::Mat & img, const std::string & filename);
+  /**
+   * Number of images waiting to be written */
+  int backlog();
+  /// statistics
+  int queued = 0;
+  int written = 0;
+  int dropped = 0;
+  int maxBacklog = 0;
+
+private:
+  static void runObj(UImageWriter * obj)
+  { // called, when thread is started
+    // transfer to the class run() function.
+    obj->run();
+  }
+  void run();
+  void toLog(const char * message);
+  struct UImageJob
+  {
+    cv::Mat img;
+    std::string filename;
+    /// time when queued
+    UTime t;
+  };
+  std::deque<UImageJob> jobs;
+  std::mutex lock;
+  std::condition_variable changed;
+  /// queue size
+  int maxQueue = 8;
+  /// when queue is full: 0 = drop oldest, 1 = drop newest, 2 = wait
+  int policy = 0;
+  int jpegQuality = 90;
+  /// writer thread nice value
+  int niceLevel = 10;
+  bool stopWriter = false;
+  std::thread * th1 = nullptr;
+  bool toConsole = false;
+  FILE * logfile = nullptr;
+  std::mutex logLock;
+};
+
+/**
+ * Make this visible to the rest of the software */
+extern UImageWriter imageWriter;
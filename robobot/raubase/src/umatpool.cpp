@@ -0,0 +1,65 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#include "umatpool.h"
+
+
+cv::Mat UMatPool::get(int stage, cv::Size size, int type)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  if (stage >= (int)buffers.size())
+    buffers.resize(stage + 1);
+  cv::Mat & buf = buffers[stage];
+  if (buf.u != nullptr and buf.u->refcount > 1)
+    // last result is still in use (e.g. returned to a mission),
+    // so let that user keep it
+    buf.release();
+  if (buf.size() != size or buf.type() != type)
+  {
+    buf.create(size, type);
+    size_t bytes = buf.total() * buf.elemSize();
+    frameBytes += bytes;
+    allocatedBytes += bytes;
+    allocations++;
+  }
+  return buf;
+}
+
+void UMatPool::newFrame()
+{
+  std::lock_guard<std::mutex> guard(lock);
+  lastBytes = frameBytes;
+  frameBytes = 0;
+  frames++;
+}
+
+size_t UMatPool::lastFrameBytes()
+{
+  return lastBytes;
+}
+
+float UMatPool::bytesPerFrame()
+{
+  if (frames == 0)
+    return 0;
+  return float(allocatedBytes) / float(frames);
+}
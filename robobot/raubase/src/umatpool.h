@@ -0,0 +1,68 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include <opencv2/core.hpp>
+
+/**
+ * Pool of image buffers for one image processing pipeline.
+ * Each processing stage gets its own buffer, that is reused
+ * for the next frame, if size and type are unchanged and
+ * the buffer is no longer used elsewhere.
+ * Allocations are counted, so that the allocated bytes
+ * per frame can be logged.
+ * */
+class UMatPool
+{
+public:
+  /**
+   * Get the buffer for this stage.
+   * \param stage is the pipeline stage number (0 and up).
+   * \param size, type is the needed image size and type.
+   * \returns an image of this size and type. The content is
+   * from the last use, so set the values if needed. */
+  cv::Mat get(int stage, cv::Size size, int type);
+  /**
+   * Mark the start of a new frame (for the per frame statistics) */
+  void newFrame();
+  /**
+   * Bytes allocated in the last frame */
+  size_t lastFrameBytes();
+  /**
+   * Average bytes allocated per frame (since start) */
+  float bytesPerFrame();
+  /// number of frames and total allocated bytes (since start)
+  int frames = 0;
+  size_t allocatedBytes = 0;
+  /// number of allocations
+  int allocations = 0;
+
+private:
+  std::mutex lock;
+  std::vector<cv::Mat> buffers;
+  size_t frameBytes = 0;
+  size_t lastBytes = 0;
+};
+
@@ -0,0 +1,309 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#include <string.h>
+#include <unistd.h>
+#include <opencv2/imgcodecs.hpp>
+
+#include "umjpegfile.h"
+
+static const char fileMagic[8] = {'R', 'A', 'U', 'M', 'J', 'P', 'G', '1'};
+/// "FRM1" as little endian
+static const uint32_t recordMagic = 0x314d5246;
+
+
+UMjpegRecorder::~UMjpegRecorder()
+{
+  close();
+}
+
+bool UMjpegRecorder::open(const std::string & fn, int width, int height)
+{
+  close();
+  file = fopen(fn.c_str(), "wb");
+  if (file == nullptr)
+  {
+    printf("# UMjpegRecorder::open: failed to create %s\n", fn.c_str());
+    return false;
+  }
+  filename = fn;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, fileMagic, sizeof(header.magic));
+  header.width = width;
+  header.height = height;
+  fwrite(&header, sizeof(header), 1, file);
+  index.clear();
+  frames = 0;
+  dropped = 0;
+  bytes = sizeof(header);
+  stopWriter = false;
+  th1 = new std::thread(runObj, this);
+  return true;
+}
+
+void UMjpegRecorder::close()
+{
+  if (th1 != nullptr)
+  { // write the rest
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      stopWriter = true;
+    }
+    changed.notify_all();
+    th1->join();
+    delete th1;
+    th1 = nullptr;
+  }
+  if (file != nullptr)
+  { // index at the end, and its position in the header
+    header.indexOffset = ftello(file);
+    header.count = index.size();
+    fwrite(index.data(), sizeof(UMjpegIndex), index.size(), file);
+    fseeko(file, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, file);
+    fclose(file);
+    file = nullptr;
+  }
+}
+
+bool UMjpegRecorder::add(const cv::Mat & jpeg, int seq, UTime & t)
+{
+  if (th1 == nullptr or jpeg.empty())
+    return false;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    if (queue.size() >= maxQueue)
+    { // writer is behind
+      dropped++;
+      return false;
+    }
+    queue.emplace_back();
+    UMjpegFrame & f = queue.back();
+    if (not spare.empty())
+    { // reuse a buffer
+      f.data.swap(spare.back());
+      spare.pop_back();
+    }
+    f.data.assign(jpeg.data, jpeg.data + jpeg.total());
+    f.rec.magic = recordMagic;
+    f.rec.seq = seq;
+    f.rec.sec = t.getSec();
+    f.rec.usec = t.getMicrosec();
+    f.rec.size = f.data.size();
+  }
+  changed.notify_all();
+  return true;
+}
+
+void UMjpegRecorder::run()
+{
+  while (true)
+  {
+    UMjpegFrame f;
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      changed.wait(guard, [this]{ return stopWriter or not queue.empty(); });
+      if (queue.empty())
+        // stopped, and all is written
+        break;
+      f = std::move(queue.front());
+      queue.pop_front();
+    }
+    UMjpegIndex idx;
+    memset(&idx, 0, sizeof(idx));
+    idx.offset = ftello(file);
+    idx.sec = f.rec.sec;
+    idx.usec = f.rec.usec;
+    idx.seq = f.rec.seq;
+    idx.size = f.rec.size;
+    fwrite(&f.rec, sizeof(f.rec), 1, file);
+    fwrite(f.data.data(), 1, f.data.size(), file);
+    index.push_back(idx);
+    frames++;
+    bytes += sizeof(f.rec) + f.data.size();
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      spare.push_back(std::move(f.data));
+    }
+  }
+  fflush(file);
+}
+
+///////////////////////////////////////////////////////////////
+
+UMjpegPlayer::~UMjpegPlayer()
+{
+  close();
+}
+
+bool UMjpegPlayer::open(const std::string & filename, bool realtimePlay, bool loopPlay)
+{
+  close();
+  file = fopen(filename.c_str(), "rb");
+  if (file == nullptr)
+  {
+    printf("# UMjpegPlayer::open: failed to open %s\n", filename.c_str());
+    return false;
+  }
+  realtime = realtimePlay;
+  loop = loopPlay;
+  if (not readIndex())
+  {
+    printf("# UMjpegPlayer::open: %s is not a recording\n", filename.c_str());
+    close();
+    return false;
+  }
+  next = 0;
+  restart = true;
+  printf("# UMjpegPlayer::open: %s %dx%d, %d frames\n", filename.c_str(), width, height, count());
+  return true;
+}
+
+void UMjpegPlayer::close()
+{
+  if (file != nullptr)
+  {
+    fclose(file);
+    file = nullptr;
+  }
+  index.clear();
+}
+
+bool UMjpegPlayer::readIndex()
+{
+  UMjpegFileHeader h;
+  if (fread(&h, sizeof(h), 1, file) != 1 or memcmp(h.magic, fileMagic, sizeof(h.magic)) != 0)
+    return false;
+  width = h.width;
+  height = h.height;
+  index.clear();
+  if (h.indexOffset > 0 and h.count > 0)
+  {
+    index.resize(h.count);
+    fseeko(file, h.indexOffset, SEEK_SET);
+    if (fread(index.data(), sizeof(UMjpegIndex), h.count, file) == h.count)
+      return true;
+    index.clear();
+  }
+  // no index, so scan all records
+  printf("# UMjpegPlayer: no index (recording not closed), scanning file\n");
+  uint64_t offset = sizeof(h);
+  fseeko(file, offset, SEEK_SET);
+  UMjpegRecord rec;
+  while (fread(&rec, sizeof(rec), 1, file) == 1 and rec.magic == recordMagic)
+  {
+    UMjpegIndex idx;
+    memset(&idx, 0, sizeof(idx));
+    idx.offset = offset;
+    idx.sec = rec.sec;
+    idx.usec = rec.usec;
+    idx.seq = rec.seq;
+    idx.size = rec.size;
+    offset += sizeof(rec) + rec.size;
+    if (fseeko(file, offset, SEEK_SET) != 0)
+      break;
+    index.push_back(idx);
+  }
+  return true;
+}
+
+bool UMjpegPlayer::grab(UTime & t)
+{
+  if (file == nullptr)
+    return false;
+  if (next >= count())
+  {
+    if (not loop or count() == 0)
+      return false;
+    next = 0;
+    restart = true;
+  }
+  const UMjpegIndex & idx = index[next];
+  data.resize(idx.size);
+  if (fseeko(file, idx.offset + sizeof(UMjpegRecord), SEEK_SET) != 0 or
+      fread(data.data(), 1, idx.size, file) != idx.size)
+  { // truncated file
+    next = count();
+    return false;
+  }
+  recordedTime.setTime(idx.sec, idx.usec);
+  recordedSeq = idx.seq;
+  next++;
+  if (realtime)
+  { // keep the recorded frame interval
+    if (restart)
+    {
+      playStart.now();
+      recordStart = recordedTime;
+      restart = false;
+    }
+    float wait = (recordedTime - recordStart) - playStart.getTimePassed();
+    if (wait > 0 and wait < 1.0)
+      usleep(int(wait * 1e6));
+    else if (wait >= 1.0)
+      // a gap in the recording, continue from here
+      restart = true;
+  }
+  t.now();
+  return true;
+}
+
+cv::Mat UMjpegPlayer::jpeg()
+{
+  if (data.empty())
+    return cv::Mat();
+  return cv::Mat(1, data.size(), CV_8U, data.data());
+}
+
+bool UMjpegPlayer::retrieve(cv::Mat & img, int flags)
+{
+  if (data.empty())
+    return false;
+  cv::imdecode(jpeg(), flags, &img);
+  return not img.empty();
+}
+
+bool UMjpegPlayer::seek(UTime t)
+{ // frames are in time order
+  int lo = 0;
+  int hi = count();
+  while (lo < hi)
+  {
+    int mid = (lo + hi) / 2;
+    UTime tm;
+    tm.setTime(index[mid].sec, index[mid].usec);
+    if (tm < t)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return seekIndex(lo);
+}
+
+bool UMjpegPlayer::seekIndex(int i)
+{
+  if (i < 0 or i >= count())
+    return false;
+  next = i;
+  restart = true;
+  return true;
+}
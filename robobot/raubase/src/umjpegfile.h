@@ -0,0 +1,209 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string>
+#include <condition_variable>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#include "utime.h"
+
+/**
+ * MJPEG run recording file format (all host byte order):
+ * - file header (UMjpegFileHeader)
+ * - frames, each a record header (UMjpegRecord) followed by the JPEG data
+ *   as received from the camera (not decoded or re-encoded)
+ * - index of all frames (UMjpegIndex), written when the recording is closed.
+ * If the index is missing (e.g. the recording was not closed),
+ * the player rebuilds it from the record headers.
+ * */
+struct UMjpegFileHeader
+{
+  char magic[8];
+  uint32_t width;
+  uint32_t height;
+  /// file offset of the index (0 if not written)
+  uint64_t indexOffset;
+  /// number of frames in the index
+  uint32_t count;
+  uint32_t spare;
+};
+
+struct UMjpegRecord
+{
+  uint32_t magic;
+  /// camera frame number
+  uint32_t seq;
+  /// capture time
+  int64_t sec;
+  uint32_t usec;
+  /// bytes of JPEG data following this header
+  uint32_t size;
+};
+
+struct UMjpegIndex
+{
+  /// file offset of record header
+  uint64_t offset;
+  int64_t sec;
+  uint32_t usec;
+  uint32_t seq;
+  uint32_t size;
+  uint32_t spare;
+};
+
+/**
+ * Records the camera MJPEG frames as received, to a file with
+ * time and sequence index.
+ * Frames are copied to a buffer (no decoding) and written by a separate
+ * thread; if the writer can not keep up, frames are dropped (and counted).
+ * */
+class UMjpegRecorder
+{
+public:
+  ~UMjpegRecorder();
+  /**
+   * Create file and start writer thread
+   * \param filename is the file to create
+   * \param width, height is the image size (for the player)
+   * \returns false if the file could not be created */
+  bool open(const std::string & filename, int width, int height);
+  /**
+   * Write the remaining frames and the index, and close the file */
+  void close();
+  bool isOpen()
+  {
+    return th1 != nullptr;
+  }
+  /**
+   * Add a frame (copied to a buffer).
+   * \param jpeg is the frame data as received from camera (1 x N, CV_8U)
+   * \param seq is the camera frame number
+   * \param t is the capture time
+   * \returns false if dropped */
+  bool add(const cv::Mat & jpeg, int seq, UTime & t);
+  /// statistics
+  int frames = 0;
+  int dropped = 0;
+  uint64_t bytes = 0;
+  std::string filename;
+
+private:
+  static void runObj(UMjpegRecorder * obj)
+  { // called, when thread is started
+    // transfer to the class run() function.
+    obj->run();
+  }
+  void run();
+  struct UMjpegFrame
+  {
+    UMjpegRecord rec;
+    std::vector<uchar> data;
+  };
+  /// frames waiting to be written
+  std::deque<UMjpegFrame> queue;
+  /// used buffers (to avoid allocation)
+  std::vector<std::vector<uchar>> spare;
+  const size_t maxQueue = 30;
+  std::mutex lock;
+  std::condition_variable changed;
+  bool stopWriter = false;
+  std::thread * th1 = nullptr;
+  FILE * file = nullptr;
+  UMjpegFileHeader header;
+  std::vector<UMjpegIndex> index;
+};
+
+/**
+ * Plays a recording made by UMjpegRecorder in place of the camera,
+ * frames are returned at the recorded frame rate (or as fast as possible).
+ * */
+class UMjpegPlayer
+{
+public:
+  ~UMjpegPlayer();
+  /**
+   * Open recording and read (or rebuild) the index
+   * \param realtime if true, then grab() waits to keep recorded frame rate
+   * \param loop if true, then start again at end of recording
+   * \returns false if not a valid recording */
+  bool open(const std::string & filename, bool realtime = true, bool loop = false);
+  void close();
+  bool isOpen()
+  {
+    return file != nullptr;
+  }
+  /**
+   * Get next frame from file
+   * \param t is set to the time now, and the recorded time is in recordedTime,
+   *        as other data (pose etc.) is live.
+   * \returns false at end of recording (if not looping) */
+  bool grab(UTime & t);
+  /**
+   * Decode the grabbed frame
+   * \param flags is cv::imdecode flags */
+  bool retrieve(cv::Mat & img, int flags = cv::IMREAD_COLOR);
+  /**
+   * Grabbed frame JPEG data (1 x N, CV_8U), valid until next grab() */
+  cv::Mat jpeg();
+  /**
+   * Continue from the first frame recorded at or after this time
+   * \returns false if time is after the recording */
+  bool seek(UTime t);
+  /**
+   * Continue from this frame index */
+  bool seekIndex(int i);
+  /// image size from file header
+  int width = 0;
+  int height = 0;
+  /// number of frames and the next frame index
+  int count()
+  {
+    return index.size();
+  }
+  int next = 0;
+  /// recorded time and camera sequence number of grabbed frame
+  UTime recordedTime;
+  int recordedSeq = 0;
+
+private:
+  /**
+   * Read index from end of file, or scan the records */
+  bool readIndex();
+  FILE * file = nullptr;
+  std::vector<UMjpegIndex> index;
+  std::vector<uchar> data;
+  bool realtime = true;
+  bool loop = false;
+  /// pacing: the recorded time that is played at playStart
+  UTime playStart;
+  UTime recordStart;
+  bool restart = true;
+};
@@ -0,0 +1,306 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#include <stdio.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include "ureactor.h"
+#include "uservice.h"
+
+// create value
+UReactor reactor;
+
+
+void UReactor::setup()
+{ // ensure there is default values in ini-file
+  if (not ini.has("reactor"))
+  { // no data yet, so generate some default values
+    ini["reactor"]["log"] = "true";
+    ini["reactor"]["print"] = "false";
+  }
+  toConsole = ini["reactor"]["print"] == "true";
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+  wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (epfd < 0 or wakeFd < 0)
+  {
+    perror("# UReactor::setup failed");
+    return;
+  }
+  epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = wakeFd;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, wakeFd, &ev);
+  if (ini["reactor"]["log"] == "true")
+  { // open logfile
+    std::string fn = service.logPath + "log_reactor.txt";
+    logfile = fopen(fn.c_str(), "w");
+    fprintf(logfile, "%% I/O and timer reactor (%s)\n", fn.c_str());
+    fprintf(logfile, "%% 1 \tTime (sec)\n");
+    fprintf(logfile, "%% 2 \tMessage, e.g. handler added or removed\n");
+  }
+  th1 = new std::thread(runObj, this);
+  reactorId = th1->get_id();
+}
+
+void UReactor::terminate()
+{ // modules should have removed their handlers
+  if (th1 != nullptr)
+  {
+    stopReactor = true;
+    wake();
+    if (inReactor())
+      // called from a callback, the thread ends after this call
+      th1->detach();
+    else
+      th1->join();
+    delete th1;
+    th1 = nullptr;
+  }
+  if (logfile != nullptr)
+  { // call statistics for all handlers
+    std::lock_guard<std::mutex> lock(handlerLock);
+    std::lock_guard<std::mutex> guard(logLock);
+    for (auto & h : handlers)
+      removed.push_back(h.second);
+    fprintf(logfile, "%% handler statistics\n");
+    fprintf(logfile, "%% calls, mean (ms), max (ms), name\n");
+    for (auto & h : removed)
+    {
+      float mean = 0;
+      if (h->calls > 0)
+        mean = h->sumSec / h->calls * 1000;
+      fprintf(logfile, "%% %8d %8.3f %8.3f %s\n", h->calls, mean, h->maxSec * 1000, h->name.c_str());
+    }
+    fclose(logfile);
+    logfile = nullptr;
+  }
+}
+
+bool UReactor::addFd(int fd, uint32_t events, const char * name, FdCallback cb)
+{
+  return addHandler(fd, events, name, cb, nullptr, false, false);
+}
+
+void UReactor::removeFd(int fd)
+{
+  removeHandler(fd);
+}
+
+int UReactor::addTimer(float periodSec, const char * name, Callback cb, float firstSec)
+{
+  if (epfd < 0)
+    return -1;
+  int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (fd < 0)
+    return -1;
+  if (firstSec <= 0)
+    firstSec = periodSec;
+  auto toSpec = [](float sec, timespec & ts)
+  {
+    ts.tv_sec = long(sec);
+    ts.tv_nsec = long((sec - ts.tv_sec) * 1e9);
+  };
+  itimerspec its;
+  memset(&its, 0, sizeof(its));
+  toSpec(periodSec, its.it_interval);
+  toSpec(firstSec, its.it_value);
+  if (its.it_value.tv_sec == 0 and its.it_value.tv_nsec == 0)
+    // zero would disarm the timer
+    its.it_value.tv_nsec = 1;
+  timerfd_settime(fd, 0, &its, nullptr);
+  if (not addHandler(fd, EPOLLIN, name, nullptr, cb, true, periodSec <= 0))
+  {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+void UReactor::removeTimer(int id)
+{
+  removeHandler(id);
+}
+
+void UReactor::post(Callback cb)
+{
+  if (th1 == nullptr)
+  { // no reactor, so call now
+    cb();
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(postLock);
+    posted.push_back(cb);
+  }
+  wake();
+}
+
+void UReactor::wake()
+{
+  uint64_t one = 1;
+  if (write(wakeFd, &one, sizeof(one)) != sizeof(one))
+    // counter full, so the reactor is woken already
+    perror("# UReactor::wake");
+}
+
+bool UReactor::addHandler(int fd, uint32_t events, const char * name,
+                          FdCallback fdCb, Callback cb, bool timer, bool oneShot)
+{
+  if (epfd < 0 or fd < 0)
+    return false;
+  auto h = std::make_shared<Handler>();
+  h->name = name;
+  h->fdCb = fdCb;
+  h->cb = cb;
+  h->timer = timer;
+  h->oneShot = oneShot;
+  {
+    std::lock_guard<std::mutex> lock(handlerLock);
+    handlers[fd] = h;
+  }
+  epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events;
+  ev.data.fd = fd;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) != 0)
+  {
+    std::lock_guard<std::mutex> lock(handlerLock);
+    handlers.erase(fd);
+    return false;
+  }
+  const int MSL = 200;
+  char s[MSL];
+  snprintf(s, MSL, "added %s (fd %d)", name, fd);
+  toLog(s);
+  return true;
+}
+
+void UReactor::removeHandler(int fd)
+{
+  std::shared_ptr<Handler> h;
+  {
+    std::lock_guard<std::mutex> lock(handlerLock);
+    auto it = handlers.find(fd);
+    if (it == handlers.end())
+      return;
+    h = it->second;
+    handlers.erase(it);
+    removed.push_back(h);
+  }
+  epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+  if (h->timer)
+    close(fd);
+  const int MSL = 200;
+  char s[MSL];
+  snprintf(s, MSL, "removed %s (fd %d) after %d calls", h->name.c_str(), fd, h->calls);
+  toLog(s);
+}
+
+void UReactor::run()
+{
+  const int MAX_EVENTS = 16;
+  epoll_event events[MAX_EVENTS];
+  std::vector<Callback> todo;
+  // signals (ctrl-C) terminate all modules, that must be
+  // handled by another thread, as termination needs the reactor
+  sigset_t sigs;
+  sigemptyset(&sigs);
+  sigaddset(&sigs, SIGINT);
+  sigaddset(&sigs, SIGQUIT);
+  sigaddset(&sigs, SIGHUP);
+  sigaddset(&sigs, SIGPWR);
+  sigaddset(&sigs, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &sigs, nullptr);
+  while (not stopReactor)
+  { // wait for any I/O or timer (no timeout needed)
+    int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      perror("# UReactor::run: epoll_wait failed");
+      break;
+    }
+    for (int i = 0; i < n and not stopReactor; i++)
+    {
+      int fd = events[i].data.fd;
+      if (fd == wakeFd)
+      { // posted functions (or stop)
+        uint64_t cnt;
+        if (read(wakeFd, &cnt, sizeof(cnt)) < 0 and errno != EAGAIN)
+          perror("# UReactor::run: wake read failed");
+        {
+          std::lock_guard<std::mutex> lock(postLock);
+          todo.swap(posted);
+        }
+        for (auto & cb : todo)
+          cb();
+        todo.clear();
+        continue;
+      }
+      std::shared_ptr<Handler> h;
+      {
+        std::lock_guard<std::mutex> lock(handlerLock);
+        auto it = handlers.find(fd);
+        if (it != handlers.end())
+          h = it->second;
+      }
+      if (not h)
+        // removed by an earlier callback
+        continue;
+      UTime t("now");
+      if (h->timer)
+      { // timer expired (maybe more than once)
+        uint64_t expired = 0;
+        if (read(fd, &expired, sizeof(expired)) == sizeof(expired))
+          h->cb();
+        if (h->oneShot)
+          removeHandler(fd);
+      }
+      else
+        h->fdCb(events[i].events);
+      float dt = t.getTimePassed();
+      h->calls++;
+      h->sumSec += dt;
+      if (dt > h->maxSec)
+        h->maxSec = dt;
+    }
+  }
+}
+
+void UReactor::toLog(const char * message)
+{
+  UTime t("now");
+  std::lock_guard<std::mutex> guard(logLock);
+  if (logfile != nullptr)
+    fprintf(logfile, "%lu.%04ld %s\n", t.getSec(), t.getMicrosec()/100, message);
+  if (toConsole)
+    printf("%lu.%04ld %s\n", t.getSec(), t.getMicrosec()/100, message);
+}
@@ -0,0 +1,135 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#pragma once
+
+#include <stdint.h>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "utime.h"
+
+/**
+ * One thread that waits (epoll) for all file descriptor I/O
+ * (Teensy serial port, vision socket, joystick, stdin) and periodic
+ * timers (timerfd), and calls the owning module when there is something to do.
+ * This replaces a read thread per device, each polling with a sleep.
+ *
+ * Callbacks are called from the reactor thread, one at a time,
+ * so they must not block (no waiting for other devices).
+ * When a handler is removed from another thread, a callback
+ * already started may still be running.
+ * */
+class UReactor
+{
+public:
+  /// called with the epoll events (EPOLLIN, EPOLLHUP, ...)
+  using FdCallback = std::function<void(uint32_t events)>;
+  using Callback = std::function<void()>;
+  /** create epoll and start reactor thread */
+  void setup();
+  /**
+   * Stop reactor thread, and write handler statistics */
+  void terminate();
+  /**
+   * Call this function, when there are events on this file descriptor.
+   * \param fd is the (open) file descriptor, should be non-blocking.
+   * \param events is e.g. EPOLLIN (level triggered)
+   * \param name is used in the statistics
+   * \returns false if the reactor is not running or fd is not valid */
+  bool addFd(int fd, uint32_t events, const char * name, FdCallback cb);
+  /**
+   * Stop calling for this file descriptor, call before closing the fd. */
+  void removeFd(int fd);
+  /**
+   * Call this function periodically (timerfd, CLOCK_MONOTONIC).
+   * \param periodSec is the period, 0 is a one-shot timer.
+   * \param firstSec is the time to the first call, if <= 0, then one period.
+   * \returns timer id (for removeTimer), or -1 if failed */
+  int addTimer(float periodSec, const char * name, Callback cb, float firstSec = 0);
+  void removeTimer(int id);
+  /**
+   * Call this function once from the reactor thread (as soon as possible),
+   * or now, if the reactor is not running */
+  void post(Callback cb);
+  /**
+   * Is the caller the reactor thread */
+  bool inReactor()
+  {
+    return th1 != nullptr and std::this_thread::get_id() == reactorId;
+  }
+
+private:
+  static void runObj(UReactor * obj)
+  { // called, when thread is started
+    // transfer to the class run() function.
+    obj->run();
+  }
+  void run();
+  /**
+   * Wake reactor thread (posted functions or stop) */
+  void wake();
+  bool addHandler(int fd, uint32_t events, const char * name,
+                  FdCallback fdCb, Callback cb, bool timer, bool oneShot);
+  void removeHandler(int fd);
+  void toLog(const char * message);
+  struct Handler
+  {
+    std::string name;
+    FdCallback fdCb;
+    Callback cb;
+    /// fd is a timerfd (owned by the reactor)
+    bool timer = false;
+    bool oneShot = false;
+    /// statistics
+    int calls = 0;
+    float maxSec = 0;
+    float sumSec = 0;
+  };
+  /// callbacks for each file descriptor
+  std::map<int, std::shared_ptr<Handler>> handlers;
+  /// removed handlers, for statistics
+  std::vector<std::shared_ptr<Handler>> removed;
+  std::mutex handlerLock;
+  /// posted functions
+  std::vector<Callback> posted;
+  std::mutex postLock;
+  int epfd = -1;
+  /// eventfd to wake the reactor (post and terminate)
+  int wakeFd = -1;
+  std::atomic<bool> stopReactor{false};
+  std::thread * th1 = nullptr;
+  std::thread::id reactorId;
+  bool toConsole = false;
+  FILE * logfile = nullptr;
+  std::mutex logLock;
+};
+
+/**
+ * Make this visible to the rest of the software */
+extern UReactor reactor;
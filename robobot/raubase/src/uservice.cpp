@@ -24,8 +24,11 @@
 
 #include <stdio.h>
 #include <signal.h>
+#include <ctype.h>
+#include <errno.h>
 #include "CLI/CLI.hpp"
 #include <filesystem>
+#include <sys/epoll.h>
 
 #include "uini.h"
 #include "cmotor.h"
@@ -37,6 +40,8 @@
 #include "mpose.h"
 #include "maruco.h"
 #include "mgolfball.h"
+#include "mgolftrack.h"
+#include "mvision.h"
 #include "scam.h"
 #include "sdist.h"
 #include "sedge.h"
@@ -47,6 +52,8 @@
 #include "spyvision.h"
 #include "sstate.h"
 #include "steensy.h"
+#include "uimagewriter.h"
+#include "ureactor.h"
 #include "uservice.h"
 
 #define REV "$Id: uservice.cpp 586 2024-01-24 12:42:37Z jcan $"
@@ -94,6 +101,10 @@ bool UService::setup(int argc,char **argv)
   cli.add_flag("-m,--cam-calibrate", camCal, "Calibrate camera using checkboard images");
   bool camImg{false};
   cli.add_flag("-i,--image", camImg, "Save image from camera");
+  bool geometryBench{false};
+  cli.add_flag("--geometry-bench", geometryBench, "Compare camera geometry conversions with the cv::Mat versions");
+  bool colorBench{false};
+  cli.add_flag("--color-bench", colorBench, "Compare golfball colour lookup table with HSV filter on a camera image");
   // gyro offset
   bool calibGyro = false;
   cli.add_flag("-g,--gyro", calibGyro, "Calibrate gyro offset");
@@ -182,6 +193,8 @@ bool UService::setup(int argc,char **argv)
     { // failed (probably: path exist already)
       std::perror("#*** UService:: Failed to create log path:");
     }
+    // device I/O and timers for all modules
+    reactor.setup();
     if (teensyConnect)
     { // open the main data source
       printf("# UService::setup: open to Teensy\n");
@@ -217,9 +230,12 @@ bool UService::setup(int argc,char **argv)
     pyvision.setup();
     dist.setup();
     joyLogi.setup();
+    imageWriter.setup();
     cam.setup();
     aruco.setup();
     golfball.setup();
+    golftrack.setup();
+    vision.setup();
 
     setupComplete = true;
     usleep(2000);
@@ -232,6 +248,10 @@ bool UService::setup(int argc,char **argv)
       cam.saveImage();
     else if (camCal)
       cam.calibrate();
+    else if (colorBench)
+      golfball.benchmarkColor();
+    else if (geometryBench)
+      cam.benchmarkGeometry();
     else
       theEnd = false;
   }
@@ -266,7 +286,10 @@ bool UService::setup(int argc,char **argv)
   }
   if (not theEnd)
   { // start listen to the keyboard
-    th1 = new std::thread(runObj, this);
+    gotKeyInput = false;
+    if (not asDaemon)
+      keyboardInReactor = reactor.addFd(STDIN_FILENO, EPOLLIN, "keyboard",
+                                        [this](uint32_t events){ readKeyboard(events); });
     th2 = new std::thread(runObj2, this);
   }
   // wait for optional tasks that require system to run.
@@ -316,7 +339,11 @@ bool UService::decode(const char* msg, UTime& msgTime)
 void UService::stopNow(const char * who)
 { // request a terminate and exit
   printf("# UService:: %s say stop now\n", who);
-  stopNowRequest = true;
+  {
+    std::lock_guard<std::mutex> lock(stopLock);
+    stopNowRequest = true;
+  }
+  stopCv.notify_all();
 }
 
 
@@ -328,6 +355,10 @@ void UService::terminate()
   teensy1.send("stop\n");
   terminating = true;
   stop = true; // stop all threads, when finished current activity
+  {
+    std::lock_guard<std::mutex> lock(stopLock);
+  }
+  stopCv.notify_all();
   //
   usleep(100000);
   joyLogi.terminate();
@@ -346,9 +377,17 @@ void UService::terminate()
   dist.terminate();
   // terminate sensors before Teensy
   teensy1.terminate();
+  vision.terminate();
+  golftrack.terminate();
   pyvision.terminate();
   cam.terminate();
   aruco.terminate();
+  // write the remaining debug images
+  imageWriter.terminate();
+  if (keyboardInReactor)
+    reactor.removeFd(STDIN_FILENO);
+  // all device handlers are removed now
+  reactor.terminate();
   // service must be the last to close
   if (not ini.has("ini"))
   {
@@ -374,16 +413,31 @@ std::string UService::getVersionString()
   return part;
 }
 
-void UService::run()
+void UService::readKeyboard(uint32_t /*events*/)
 {
-  gotKeyInput = false;
-  while (not stop)
-  {
-    if (not asDaemon)
+  const int MRL = 256;
+  char rd[MRL];
+  int n = read(STDIN_FILENO, rd, MRL);
+  if (n <= 0)
+  { // end of input (or error), no more keyboard
+    if (n == 0 or (errno != EAGAIN and errno != EINTR))
     {
-      cin >> keyString;
+      reactor.removeFd(STDIN_FILENO);
+      keyboardInReactor = false;
+    }
+    return;
+  }
+  for (int i = 0; i < n; i++)
+  { // split into words (like cin >> keyString)
+    if (not isspace(rd[i]))
+      keyWord += rd[i];
+    else if (not keyWord.empty())
+    {
+      keyString = keyWord;
+      keyWord.clear();
       if (keyString == "stop")
-        signal_callback_handler(-1);
+        // terminate from the stop thread (not the reactor)
+        stopNow("keyboard");
       else
         gotKeyInput = true;
     }
@@ -391,15 +445,12 @@ void UService::run()
 }
 
 void UService::run2()
-{
-  while (not stop)
-  { // e.g. using the stop switch
-    if (stopNowRequest)
-    {
-      signal_callback_handler(-1);
-    }
-    usleep(50000);
-  }
+{ // e.g. using the stop switch or keyboard
+  std::unique_lock<std::mutex> lock(stopLock);
+  stopCv.wait(lock, [this]{ return stopNowRequest or stop; });
+  lock.unlock();
+  if (stopNowRequest)
+    signal_callback_handler(-1);
 }
 
 bool UService::gotKey()
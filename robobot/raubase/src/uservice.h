@@ -25,6 +25,9 @@
 
 #include <string>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
 #include "utime.h"
 #include "uini.h"
 
@@ -52,9 +55,11 @@ public:
      * shut down and save ini-file - but do not exit */
     void terminate();
     /**
-    * thread to listen to keyboard */
-    void run();
-    void run2(); // and terminate request
+    * read keyboard (called by the reactor, when there is input) */
+    void readKeyboard(uint32_t events);
+    /**
+     * thread waiting for terminate request */
+    void run2();
     /**
      * Got keyboard input - e.g. enter */
     bool gotKey();
@@ -78,12 +83,12 @@ public:
     bool asDaemon = false;
 
 private:
-    static void runObj(UService * obj)
-    { // called, when thread is started
-        // transfer to the class run() function.
-        obj->run();
-    }
-    std::thread * th1;
+    /// partial keyboard word
+    std::string keyWord;
+    bool keyboardInReactor = false;
+    /// wake terminate thread (run2)
+    std::mutex stopLock;
+    std::condition_variable stopCv;
     static void runObj2(UService * obj)
     { // called, when thread is started
         // transfer to the class run() function.
@@ -0,0 +1,126 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <new>
+#include <sys/mman.h>
+
+#include "ushmring.h"
+
+
+UShmRing::~UShmRing()
+{
+  close();
+}
+
+bool UShmRing::open(const std::string & shmName, int slots, size_t maxImageBytes)
+{
+  close();
+  if (slots < 2)
+    slots = 2;
+  // slots aligned to cache lines
+  const size_t align = 64;
+  size_t headerBytes = (sizeof(UShmRingHeader) + align - 1) / align * align;
+  size_t dataOffset = (sizeof(UShmSlotHeader) + align - 1) / align * align;
+  size_t slotBytes = (dataOffset + maxImageBytes + align - 1) / align * align;
+  size_t bytes = headerBytes + slots * slotBytes;
+  // a new ring for each run (a reader may still have the old one mapped)
+  shm_unlink(shmName.c_str());
+  int fd = shm_open(shmName.c_str(), O_CREAT | O_RDWR, 0644);
+  if (fd < 0)
+  {
+    printf("# UShmRing::open: failed to create %s\n", shmName.c_str());
+    return false;
+  }
+  bool ok = ftruncate(fd, bytes) == 0;
+  void * p = MAP_FAILED;
+  if (ok)
+    p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED)
+  {
+    printf("# UShmRing::open: failed to map %s (%zu bytes)\n", shmName.c_str(), bytes);
+    shm_unlink(shmName.c_str());
+    return false;
+  }
+  name = shmName;
+  mapBytes = bytes;
+  base = (uint8_t *)p;
+  // shared memory is zero filled, so all slot locks are 0 (even)
+  header = new (p) UShmRingHeader;
+  memcpy(header->magic, "RAUSHM01", sizeof(header->magic));
+  header->headerBytes = headerBytes;
+  header->slots = slots;
+  header->slotBytes = slotBytes;
+  header->dataOffset = dataOffset;
+  header->newest.store(0);
+  published = 0;
+  tooLarge = 0;
+  return true;
+}
+
+void UShmRing::close()
+{
+  if (base != nullptr)
+  {
+    munmap(base, mapBytes);
+    shm_unlink(name.c_str());
+    base = nullptr;
+    header = nullptr;
+  }
+}
+
+bool UShmRing::publish(uint64_t seq, UTime & t, Format format,
+                       int width, int height, int stride,
+                       const uint8_t * data, size_t bytes)
+{
+  if (header == nullptr)
+    return false;
+  if (header->dataOffset + bytes > header->slotBytes)
+  {
+    tooLarge++;
+    return false;
+  }
+  uint8_t * slot = base + header->headerBytes + (seq % header->slots) * header->slotBytes;
+  UShmSlotHeader * sh = (UShmSlotHeader *)slot;
+  // odd: slot is being written
+  uint32_t lock = sh->lock.load(std::memory_order_relaxed);
+  sh->lock.store(lock + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  sh->format = format;
+  sh->seq = seq;
+  sh->sec = t.getSec();
+  sh->usec = t.getMicrosec();
+  sh->width = width;
+  sh->height = height;
+  sh->stride = stride;
+  sh->bytes = bytes;
+  memcpy(slot + header->dataOffset, data, bytes);
+  // even: slot is valid again
+  sh->lock.store(lock + 2, std::memory_order_release);
+  header->newest.store(seq, std::memory_order_release);
+  published++;
+  return true;
+}
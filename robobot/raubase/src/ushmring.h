@@ -0,0 +1,121 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+#include "utime.h"
+
+/**
+ * Camera frames in a POSIX shared memory ring (/dev/shm/<name>),
+ * so that other processes (e.g. the Python vision server) can use the
+ * frames without opening the camera and without copying the image.
+ *
+ * Layout (host byte order, all offsets from start of the shared memory):
+ * - UShmRingHeader at offset 0
+ * - slot i at headerBytes + i * slotBytes, starting with UShmSlotHeader,
+ *   the image data is at dataOffset in the slot.
+ *
+ * Each slot is protected by a sequence lock (lock), that is odd while
+ * the slot is written. A reader:
+ *   1. reads 'newest' in the ring header and uses slot (newest % slots),
+ *   2. reads 'lock' in the slot (retry if odd),
+ *   3. uses the image in place (or copies it),
+ *   4. reads 'lock' again, if changed, then the slot was overwritten
+ *      while in use, and the result should be discarded.
+ * With e.g. 4 slots a slot is rewritten 3 frame periods later only.
+ * */
+struct UShmRingHeader
+{
+  /// "RAUSHM01"
+  char magic[8];
+  uint32_t headerBytes;
+  uint32_t slots;
+  uint64_t slotBytes;
+  /// image data offset in slot
+  uint64_t dataOffset;
+  /// sequence number of the newest complete frame (0 = none)
+  std::atomic<uint64_t> newest;
+};
+
+struct UShmSlotHeader
+{
+  /// sequence lock, odd while slot is written
+  std::atomic<uint32_t> lock;
+  /// frame format, see UShmRing::Format
+  uint32_t format;
+  /// frame sequence number in this ring (counts every published frame,
+  /// not UFrame::seq, as UFrame counts decoded frames only)
+  uint64_t seq;
+  /// capture time (gettimeofday time)
+  int64_t sec;
+  uint32_t usec;
+  uint32_t width;
+  uint32_t height;
+  /// bytes per image row (0 for JPEG)
+  uint32_t stride;
+  /// bytes of image data
+  uint64_t bytes;
+};
+
+/**
+ * Writer side of the shared memory frame ring.
+ * */
+class UShmRing
+{
+public:
+  enum Format {BGR8 = 0, GRAY8 = 1, MJPEG = 2};
+  ~UShmRing();
+  /**
+   * Create (or recreate) the shared memory
+   * \param name is the POSIX shared memory name, e.g. "/raubase_frames"
+   * \param slots is the number of frames in the ring
+   * \param maxImageBytes is the largest image (data) size
+   * \returns false if not created */
+  bool open(const std::string & name, int slots, size_t maxImageBytes);
+  /**
+   * Unmap and remove the shared memory */
+  void close();
+  bool isOpen()
+  {
+    return header != nullptr;
+  }
+  /**
+   * Copy a frame to the next slot, and make it the newest frame.
+   * \param data is the image data (rows of stride bytes for BGR8 and GRAY8)
+   * \returns false if the image is too large for a slot */
+  bool publish(uint64_t seq, UTime & t, Format format,
+               int width, int height, int stride,
+               const uint8_t * data, size_t bytes);
+  /// statistics
+  int published = 0;
+  int tooLarge = 0;
+  std::string name;
+
+private:
+  UShmRingHeader * header = nullptr;
+  uint8_t * base = nullptr;
+  size_t mapBytes = 0;
+};
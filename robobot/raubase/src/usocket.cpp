@@ -25,12 +25,19 @@
 #include <string>
 #include <string.h>
 #include <sys/types.h>
+#include <sys/epoll.h>
+#include <fcntl.h>
 #include "usocket.h"
+#include "ureactor.h"
 #include <stdio.h>
 
 
-USocket::USocket(const char * host, const char * port)
+USocket::USocket(const char * host, const char * port, int queueSize)
 { // set parameters
+  // all line buffers allocated here, reused when receiving
+  if (queueSize < 2)
+    queueSize = 2;
+  queue.resize(queueSize);
 //   std::string portStr = std::to_string(port);
   // create client to vision server in python
   int res;
@@ -50,22 +57,28 @@ USocket::USocket(const char * host, const char * port)
   //     std::perror("# USocket:: connect failed");
       connected = false;
       close(sockfd);
-      th1 = nullptr;
     }
     else
     { // connection established
       connected = true;
-      // start read thread
-      th1 = new std::thread(runObj, this);
+      fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL, 0) | O_NONBLOCK);
+      // receive when data is available
+      reactor.addFd(sockfd, EPOLLIN | EPOLLRDHUP, "pyvision socket",
+                    [this](uint32_t events){ receive(events); });
     }
   }
 }
 
 void USocket::terminate()
 { // wait for receive thread to finish
-  stop = true;
-  if (th1 != nullptr)
-    th1->join();
+  if (connected)
+  {
+    connected = false;
+    reactor.removeFd(sockfd);
+    // close in the reactor thread, when no receive() is running
+    int fd = sockfd;
+    reactor.post([fd](){ close(fd); });
+  }
 }
 
 bool USocket::sendCommand(std::string command)
@@ -87,35 +100,33 @@ bool USocket::sendCommand(std::string command)
   return sendOk;
 }
 
-void USocket::run()
+void USocket::receive(uint32_t /*events*/)
 {
-  const int MAX_RX_CNT = 2000;
-  char rxBuf[MAX_RX_CNT];
-  int rxCnt = 0;
-  while (connected and not stop)
-  { // receive 1 character
-    char recvChar;
-    int e = recv(sockfd, &recvChar, 1, MSG_DONTWAIT);
-    if (e == 1)
-    { /// got a character
-      // Check accepted chars
+  if (not connected)
+    return;
+  const int MAX_RD = 4096;
+  char rd[MAX_RD];
+  // all that is available
+  int e = recv(sockfd, rd, MAX_RD, MSG_DONTWAIT);
+  if (e > 0)
+  { // split into lines
+    for (int i = 0; i < e; i++)
+    { // Check accepted chars
+      char recvChar = rd[i];
       if (recvChar >=' ' or recvChar == '\n' or recvChar == '\t')
       { // collect to a string (a fixed array of characters for speed)
         rxBuf[rxCnt] = recvChar;
-        // If the line ends, terminate string and decode
+        // If the line ends, queue the line
         if (rxBuf[rxCnt] == '\n')
-        { // terminate string (replacing the newline '\n')
+        {
           rxBuf[rxCnt] = '\0';
-          // unpack this line
-          reply = rxBuf;
           // mark command as handled
           cmdSend = false;
-          replyCnt++;
-          rxTime.now();
+          push(rxBuf, rxCnt);
           // ready for next message
           rxCnt = 0;
         }
-        else if (rxCnt < MAX_RX_CNT)
+        else if (rxCnt < MAX_RX_CNT - 1)
         { // Increment string length
           rxCnt++;
         }
@@ -126,41 +137,61 @@ void USocket::run()
         }
       }
     }
-    else if (e < 0 and errno != EAGAIN)
-    { // lost connection with hardware
-      // shut down
-      printf("### lost hardware connection (errno=%d) ###\n", errno);
-      connected = false;
-      close(sockfd);
-    }
-    else
-    { // no data, wait a bit
-      usleep(900);
-    }
   }
-  if (connected)
-  {
+  else if (e == 0 or (errno != EAGAIN and errno != EINTR))
+  { // closed by server or lost connection
+    // shut down
+    printf("### lost hardware connection (errno=%d) ###\n", errno);
     connected = false;
+    reactor.removeFd(sockfd);
     close(sockfd);
+    // no more replies
+    waitCv.notify_all();
   }
 }
 
-
-std::string USocket::waitForReply(float timeoutMs)
+bool USocket::push(const char * line, int n)
 {
-  std::string r = "";
-  UTime t;
-  t.now();
-  while (replyCnt == replyCntLast and t.getTimePassed() < timeoutMs/1000.0)
-  { // wait a ms
-    usleep(1000);
+  unsigned int t = tail.load(std::memory_order_relaxed);
+  unsigned int depth = t - head.load(std::memory_order_acquire);
+  received++;
+  if (depth >= queue.size())
+  { // consumer is too slow
+    dropped++;
+    return false;
   }
-  if (replyCnt != replyCntLast)
-  { // got a reply
-    r = reply;
-    replyCntLast = replyCnt;
+  Line & q = queue[t % queue.size()];
+  // reuses the string buffer
+  q.text.assign(line, n);
+  q.t.now();
+  q.cnt = received;
+  tail.store(t + 1, std::memory_order_release);
+  if (int(depth + 1) > maxDepth)
+    maxDepth = depth + 1;
+  { // lock, so that a waiter can not miss the notification
+    std::lock_guard<std::mutex> lock(waitLock);
   }
-  return r;
+  waitCv.notify_one();
+  return true;
 }
 
-
+std::string USocket::waitForReply(float timeoutMs)
+{
+  unsigned int h = head.load(std::memory_order_relaxed);
+  if (tail.load(std::memory_order_acquire) == h and timeoutMs > 0)
+  { // wait for the receive thread
+    std::unique_lock<std::mutex> lock(waitLock);
+    waitCv.wait_for(lock, std::chrono::microseconds(int(timeoutMs * 1000)),
+                    [this, h]{ return tail.load(std::memory_order_acquire) != h; });
+  }
+  if (tail.load(std::memory_order_acquire) == h)
+    // no reply
+    return "";
+  Line & q = queue[h % queue.size()];
+  reply = q.text;
+  rxTime = q.t;
+  replyCnt = q.cnt;
+  // slot is free for the receive thread
+  head.store(h + 1, std::memory_order_release);
+  return reply;
+}
@@ -37,7 +37,12 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <netdb.h>
-#include <thread>
+#include <stdint.h>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <string>
+#include <vector>
 
 #include "utime.h"
 
@@ -47,10 +52,15 @@ using namespace std;
 class USocket
 {
 public:
-  USocket(const char * host, const char * port);
   /**
-   * Listen to socket from python vision app */
-  void run();
+   * Connect to server
+   * \param queueSize is the number of received lines that can wait
+   *        for waitForReply(), more are dropped */
+  USocket(const char * host, const char * port, int queueSize = 64);
+  /**
+   * Read from socket (called by the reactor, when data is available),
+   * puts received lines in the reply queue */
+  void receive(uint32_t events);
   /** decode an unpacked incoming messages
    * \returns true if the request is send OK */
   bool sendCommand(std::string command);
@@ -58,16 +68,25 @@ public:
    * terminate */
   void terminate();
   /**
-   * Wait for a reply from vision
+   * Wait for the oldest unused reply from vision.
+   * \param timeoutMs is max wait time, if no reply is queued already.
+   * \returns the line (without newline), or empty string if none.
+   * Sets reply, replyCnt and rxTime for the returned line.
    * */
   std::string waitForReply(float timeoutMs);
 
 public:
   int txCnt = 0;
+  /// number of the last returned reply
   int replyCnt = 0;
+  /// rxTime is the receive time of the last returned reply
   UTime txTime, rxTime;
-  bool connected = false;
+  std::atomic<bool> connected{false};
   std::string reply;
+  /// statistics: lines received, dropped (queue full), max queued
+  std::atomic<int> received{0};
+  std::atomic<int> dropped{0};
+  std::atomic<int> maxDepth{0};
 
 
 private:
@@ -77,17 +96,31 @@ private:
   int sockfd; /// Socket file descriptor
   //
   std::string command;
-  int replyCntLast = 0;
   bool cmdSend = false;
+  /**
+   * Add a received line to the queue (receive thread only)
+   * \returns false if the queue is full */
+  bool push(const char * line, int n);
+  /// one received line
+  struct Line
+  {
+    std::string text;
+    UTime t;
+    int cnt;
+  };
+  /// reply queue, single producer (receive()) and single consumer (waitForReply())
+  std::vector<Line> queue;
+  /// next to read (consumer) and next to write (producer)
+  std::atomic<unsigned int> head{0};
+  std::atomic<unsigned int> tail{0};
+  /// to wake a waiting consumer
+  std::mutex waitLock;
+  std::condition_variable waitCv;
   //
-  static void runObj(USocket * obj)
-  { // called, when thread is started
-    // transfer to the class run() function.
-    obj->run();
-  }
-  // support variables
-  std::thread * th1;
-  bool stop = false;
+  /// partial line from last receive()
+  static const int MAX_RX_CNT = 2000;
+  char rxBuf[MAX_RX_CNT];
+  int rxCnt = 0;
 };
 
 
@@ -0,0 +1,85 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#pragma once
+
+#include <string.h>
+#include <vector>
+
+#include "utime.h"
+
+/**
+ * Time used by each stage of an image processing pipeline,
+ * for the last processed image.
+ * A stage may be timed more than once per image (e.g. for each candidate),
+ * then the times are added.
+ * Costs a clock read per lap only, so it is always on.
+ * */
+class UStageTimer
+{
+public:
+  struct Stage
+  {
+    /// stage name (a string constant)
+    const char * name;
+    float ms;
+  };
+  /**
+   * Start timing of a new image (clears the stage times) */
+  void start()
+  {
+    stages.clear();
+    last.now();
+  }
+  /**
+   * Time since start (or last lap) is added to this stage
+   * \param name is the stage name, must be a string constant */
+  void lap(const char * name)
+  {
+    UTime t("now");
+    float ms = (t - last) * 1000;
+    last = t;
+    for (Stage & s : stages)
+    {
+      if (strcmp(s.name, name) == 0)
+      {
+        s.ms += ms;
+        return;
+      }
+    }
+    stages.push_back({name, ms});
+  }
+  /**
+   * Sum of all stages (ms) */
+  float total()
+  {
+    float sum = 0;
+    for (Stage & s : stages)
+      sum += s.ms;
+    return sum;
+  }
+  /// stage times for the last image, in order of first use
+  std::vector<Stage> stages;
+
+private:
+  UTime last;
+};
@@ -0,0 +1,237 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/videodev2.h>
+#include <opencv2/imgcodecs.hpp>
+
+#include "uv4l2.h"
+
+
+UV4l2::~UV4l2()
+{
+  close();
+}
+
+int UV4l2::xioctl(unsigned long request, void * arg)
+{
+  int r;
+  do
+    r = ioctl(fd, request, arg);
+  while (r == -1 and errno == EINTR);
+  return r;
+}
+
+bool UV4l2::open(int device, int w, int h, float rate, int count)
+{
+  const int MSL = 50;
+  char dev[MSL];
+  snprintf(dev, MSL, "/dev/video%d", device);
+  fd = ::open(dev, O_RDWR | O_NONBLOCK);
+  if (fd < 0)
+  {
+    printf("# UV4l2::open: failed to open %s\n", dev);
+    return false;
+  }
+  // format
+  v4l2_format fmt;
+  memset(&fmt, 0, sizeof(fmt));
+  fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  fmt.fmt.pix.width = w;
+  fmt.fmt.pix.height = h;
+  fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_MJPEG;
+  fmt.fmt.pix.field = V4L2_FIELD_ANY;
+  if (xioctl(VIDIOC_S_FMT, &fmt) < 0 or fmt.fmt.pix.pixelformat != V4L2_PIX_FMT_MJPEG)
+  {
+    printf("# UV4l2::open: %s does not support MJPEG %dx%d\n", dev, w, h);
+    close();
+    return false;
+  }
+  width = fmt.fmt.pix.width;
+  height = fmt.fmt.pix.height;
+  // frame rate
+  v4l2_streamparm parm;
+  memset(&parm, 0, sizeof(parm));
+  parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  parm.parm.capture.timeperframe.numerator = 1;
+  parm.parm.capture.timeperframe.denominator = lroundf(rate);
+  xioctl(VIDIOC_S_PARM, &parm);
+  if (parm.parm.capture.timeperframe.numerator > 0)
+    fps = float(parm.parm.capture.timeperframe.denominator) / parm.parm.capture.timeperframe.numerator;
+  // driver buffers
+  v4l2_requestbuffers req;
+  memset(&req, 0, sizeof(req));
+  req.count = count;
+  req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  req.memory = V4L2_MEMORY_MMAP;
+  if (xioctl(VIDIOC_REQBUFS, &req) < 0 or req.count < 1)
+  {
+    printf("# UV4l2::open: %s failed to get %d buffers\n", dev, count);
+    close();
+    return false;
+  }
+  buffers.resize(req.count);
+  for (int i = 0; i < (int)req.count; i++)
+  { // map buffers to user space
+    v4l2_buffer buf;
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = i;
+    void * p = MAP_FAILED;
+    if (xioctl(VIDIOC_QUERYBUF, &buf) == 0)
+      p = mmap(nullptr, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buf.m.offset);
+    if (p == MAP_FAILED)
+    {
+      printf("# UV4l2::open: %s failed to map buffer %d\n", dev, i);
+      buffers.resize(i);
+      close();
+      return false;
+    }
+    buffers[i].start = p;
+    buffers[i].length = buf.length;
+    // and give it to the driver
+    xioctl(VIDIOC_QBUF, &buf);
+  }
+  bufferCount = req.count;
+  v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  if (xioctl(VIDIOC_STREAMON, &type) < 0)
+  {
+    printf("# UV4l2::open: %s failed to start streaming\n", dev);
+    close();
+    return false;
+  }
+  return true;
+}
+
+void UV4l2::close()
+{
+  if (fd >= 0)
+  {
+    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    xioctl(VIDIOC_STREAMOFF, &type);
+    for (auto & b : buffers)
+      munmap(b.start, b.length);
+    buffers.clear();
+    ::close(fd);
+    fd = -1;
+  }
+  current = -1;
+}
+
+void UV4l2::requeue()
+{
+  if (current >= 0)
+  {
+    v4l2_buffer buf;
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = current;
+    xioctl(VIDIOC_QBUF, &buf);
+    current = -1;
+  }
+}
+
+bool UV4l2::grab(UTime & t, int timeoutMs)
+{
+  if (fd < 0)
+    return false;
+  // the previous frame is no longer needed
+  requeue();
+  pollfd pfd = {fd, POLLIN, 0};
+  int r = poll(&pfd, 1, timeoutMs);
+  if (r <= 0)
+    return false;
+  v4l2_buffer buf;
+  memset(&buf, 0, sizeof(buf));
+  buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  buf.memory = V4L2_MEMORY_MMAP;
+  if (xioctl(VIDIOC_DQBUF, &buf) < 0)
+    return false;
+  current = buf.index;
+  currentBytes = buf.bytesused;
+  // driver time is most likely monotonic clock,
+  // convert to the time of day used elsewhere
+  t.now();
+  if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+  {
+    timespec mono;
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    float age = float(mono.tv_sec - buf.timestamp.tv_sec) +
+                float(mono.tv_nsec / 1000 - buf.timestamp.tv_usec) * 1e-6;
+    if (age > 0 and age < 1.0)
+      t -= age;
+  }
+  else if (buf.timestamp.tv_sec > 0)
+    t.setTime(buf.timestamp);
+  return true;
+}
+
+cv::Mat UV4l2::jpeg()
+{
+  if (current < 0)
+    return cv::Mat();
+  return cv::Mat(1, currentBytes, CV_8U, buffers[current].start);
+}
+
+bool UV4l2::retrieve(cv::Mat & img, int flags)
+{
+  if (current < 0 or currentBytes == 0)
+    return false;
+  cv::imdecode(jpeg(), flags, &img);
+  return not img.empty();
+}
+
+bool UV4l2::setControl(unsigned int id, int value)
+{
+  if (fd < 0)
+    return false;
+  v4l2_control ctrl;
+  memset(&ctrl, 0, sizeof(ctrl));
+  ctrl.id = id;
+  ctrl.value = value;
+  return xioctl(VIDIOC_S_CTRL, &ctrl) == 0;
+}
+
+bool UV4l2::setExposure(int exposure, int gain)
+{
+  bool ok;
+  if (exposure >= 0)
+  {
+    ok = setControl(V4L2_CID_EXPOSURE_AUTO, V4L2_EXPOSURE_MANUAL);
+    ok &= setControl(V4L2_CID_EXPOSURE_ABSOLUTE, exposure);
+  }
+  else
+    ok = setControl(V4L2_CID_EXPOSURE_AUTO, V4L2_EXPOSURE_APERTURE_PRIORITY);
+  if (gain >= 0)
+    ok &= setControl(V4L2_CID_GAIN, gain);
+  return ok;
+}
@@ -0,0 +1,116 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+
+#pragma once
+
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#include "utime.h"
+
+/**
+ * Camera capture directly through Video4Linux2 (V4L2),
+ * using memory mapped driver buffers in MJPEG format.
+ * The frame time is the capture time stamped by the driver,
+ * and the number of driver buffers can be kept low,
+ * to avoid frames waiting in a queue.
+ * A frame is decoded only when retrieve() is called.
+ * */
+class UV4l2
+{
+public:
+  ~UV4l2();
+  /**
+   * Open device and start streaming
+   * \param device is the video device number (/dev/videoN)
+   * \param width, height is the requested image size
+   * \param rate is the requested frame rate (rounded to whole frames per second)
+   * \param bufferCount is the number of driver buffers (2..8)
+   * \returns true if streaming is started, fps is then the rate set by the driver */
+  bool open(int device, int width, int height, float rate, int bufferCount);
+  /**
+   * Stop streaming and close device */
+  void close();
+  /**
+   * Is device open and streaming */
+  bool isOpen()
+  {
+    return fd >= 0;
+  }
+  /**
+   * Wait for the next frame from the driver.
+   * The frame is kept (not decoded) until the next grab().
+   * \param t is set to the driver capture time (in gettimeofday time)
+   * \param timeoutMs is the max wait time
+   * \returns true if a frame is available */
+  bool grab(UTime & t, int timeoutMs = 1000);
+  /**
+   * Decode the grabbed frame
+   * \param img is the destination image
+   * \param flags is the cv::imdecode flags, e.g. cv::IMREAD_COLOR
+   * \returns false if no frame or decode failed */
+  bool retrieve(cv::Mat & img, int flags = cv::IMREAD_COLOR);
+  /**
+   * The grabbed frame as JPEG data (1 x N, CV_8U).
+   * The data is in the driver buffer, so it is valid until the next grab() only. */
+  cv::Mat jpeg();
+  /**
+   * Set exposure and gain
+   * \param exposure in 100us units, -1 is automatic exposure
+   * \param gain -1 leaves gain unchanged
+   * \returns false if a control is not supported */
+  bool setExposure(int exposure, int gain = -1);
+  /**
+   * Set a V4L2 control value (V4L2_CID_...)
+   * \returns false if not supported */
+  bool setControl(unsigned int id, int value);
+
+public:
+  /// actual image size and frame rate
+  int width = 0;
+  int height = 0;
+  float fps = 0;
+  /// actual number of driver buffers
+  int bufferCount = 0;
+
+private:
+  /**
+   * ioctl, that retries if interrupted */
+  int xioctl(unsigned long request, void * arg);
+  /**
+   * give the grabbed buffer back to the driver */
+  void requeue();
+  int fd = -1;
+  struct Buffer
+  {
+    void * start;
+    size_t length;
+  };
+  std::vector<Buffer> buffers;
+  /// index of the dequeued (grabbed) buffer, -1 if none
+  int current = -1;
+  /// bytes used in the grabbed buffer
+  size_t currentBytes = 0;
+};
+